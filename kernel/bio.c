@@ -8,6 +8,8 @@
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * breadv and bwritev do the same for up to NDISKBATCH
+//     buffers with one batch of disk requests.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -52,13 +54,19 @@ binit(void)
   }
 }
 
+// Buffers that breadahead() leaves free, for the batches
+// of a log commit and for other processes' bread()s.
+#define NSPARE (2*NDISKBATCH)
+
 // Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// If not found, allocate a buffer, unless no more than
+// spare buffers are free, in which case return 0.
+// Otherwise return locked buffer.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int spare)
 {
   struct buf *b;
+  int nfree;
 
   acquire(&bcache.lock);
 
@@ -73,6 +81,17 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached.
+  if(spare > 0){
+    nfree = 0;
+    for(b = bcache.head.next; b != &bcache.head && nfree <= spare; b = b->next)
+      if(b->refcnt == 0)
+        nfree++;
+    if(nfree <= spare){
+      release(&bcache.lock);
+      return 0;
+    }
+  }
+
   // Recycle the least recently used (LRU) unused buffer.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0) {
@@ -94,7 +113,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +121,68 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return locked bufs in bs[] for blocks blocknos[0..n-1],
+// reading all the uncached ones at once.
+void
+breadv(uint dev, uint *blocknos, int n, struct buf **bs)
+{
+  struct buf *rd[NDISKBATCH];
+  int i, nrd;
+
+  if(n > NDISKBATCH)
+    panic("breadv");
+  nrd = 0;
+  for(i = 0; i < n; i++){
+    bs[i] = bget(dev, blocknos[i], 0);
+    if(!bs[i]->valid)
+      rd[nrd++] = bs[i];
+  }
+  if(nrd > 0)
+    virtio_disk_rwv(rd, nrd, 0);
+  for(i = 0; i < nrd; i++)
+    rd[i]->valid = 1;
+}
+
+// Bring blocks blockno..blockno+n-1 into the cache with
+// one batch of disk requests, for bread()s to come.
+// Readahead is only a hint, so it stops short rather than
+// take the last NSPARE free buffers.
+void
+breadahead(uint dev, uint blockno, int n)
+{
+  struct buf *rd[NDISKBATCH], *b;
+  int i, nrd;
+
+  n = n < NDISKBATCH ? n : NDISKBATCH;
+  nrd = 0;
+  for(i = 0; i < n; i++){
+    if((b = bget(dev, blockno + i, NSPARE)) == 0)
+      break;
+    if(b->valid)
+      brelse(b);
+    else
+      rd[nrd++] = b;
+  }
+  if(nrd > 0)
+    virtio_disk_rwv(rd, nrd, 0);
+  for(i = 0; i < nrd; i++){
+    rd[i]->valid = 1;
+    brelse(rd[i]);
+  }
+}
+
+// Return a locked buf for the indicated block without reading
+// it, for a caller that is about to overwrite all of it.
+struct buf*
+bgetblk(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,6 +192,21 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the contents of n locked bufs to disk, in no
+// particular order.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  if(n > NDISKBATCH)
+    panic("bwritev");
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  virtio_disk_rwv(bs, n, 1);
+}
+
 // Release a locked buffer.
 // Move to the head of the most-recently-used list.
 void
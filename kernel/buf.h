@@ -1,6 +1,7 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ordered; // file data to write before the next commit?
   uint dev;
   uint blockno;
   struct sleeplock lock;
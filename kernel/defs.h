@@ -1,7 +1,9 @@
 struct buf;
 struct context;
 struct file;
+struct iovec;
 struct inode;
+struct logstat;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -12,8 +14,12 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadv(uint, uint*, int, struct buf**);
+void            breadahead(uint, uint, int);
+struct buf*     bgetblk(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -31,14 +37,23 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             fileseek(struct file*, int, int);
+int             filecopy(struct file*, struct file*, int);
+int             fileprealloc(struct file*, uint);
+int             filereadv(struct file*, struct iovec*, int, uint*);
 int             filestat(struct file*, uint64 addr);
+int             filesync(struct file*);
+void            filesyncall(void);
+int             filegetdents(struct file*, uint64, int n);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, int, struct iovec*, int, uint*);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+void            dirunlink(struct inode*, char*, uint);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -51,9 +66,16 @@ struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
+int             istat(uint, uint, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 void            ireclaim(int);
+int             writeiblocks(uint);
+int             cloneiblocks(void);
+int             preallociblocks(void);
+int             iprealloc(struct inode*, uint);
+int             iclone(struct inode*, struct inode*);
+int             iflush(struct inode*);
 
 // kalloc.c
 void*           kalloc(void);
@@ -63,14 +85,19 @@ void            kinit(void);
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
+void            logstat(struct logstat*);
+void            log_sync(void);
 void            end_op(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipesize(struct pipe*, int);
 
 // printf.c
 int             printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
@@ -179,6 +206,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -55,6 +56,21 @@ filedup(struct file *f)
   return f;
 }
 
+// Give disk blocks to data that writes to f's inode
+// left in memory.
+static int
+fileflush(struct file *f)
+{
+  int r;
+
+  begin_opn(writeiblocks(0));
+  ilock(f->ip);
+  r = iflush(f->ip);
+  iunlock(f->ip);
+  end_op();
+  return r;
+}
+
 // Close file f.  (Decrement ref count, close when reaches 0.)
 void
 fileclose(struct file *f)
@@ -76,12 +92,49 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
+    if(ff.type == FD_INODE && ff.writable)
+      fileflush(&ff);
     begin_op();
     iput(ff.ip);
     end_op();
   }
 }
 
+// Put f's data and metadata on disk, as fsync().
+int
+filesync(struct file *f)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    return -1;
+  r = 0;
+  if(f->type == FD_INODE)
+    r = fileflush(f);
+  log_sync();
+  return r;
+}
+
+// Put the data and metadata of every file on disk, as sync().
+void
+filesyncall(void)
+{
+  struct file *f;
+
+  for(f = ftable.file; f < ftable.file + NFILE; f++){
+    acquire(&ftable.lock);
+    if(f->ref == 0 || f->type != FD_INODE || !f->writable){
+      release(&ftable.lock);
+      continue;
+    }
+    f->ref++;
+    release(&ftable.lock);
+    fileflush(f);
+    fileclose(f);
+  }
+  log_sync();
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int
@@ -101,76 +154,301 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Read up to n entries of directory f, starting at its offset,
+// into the user array of struct dirinfo at addr. Returns the
+// number of entries read, 0 at the end of the directory.
 int
-fileread(struct file *f, uint64 addr, int n)
+filegetdents(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  struct proc *p = myproc();
+  struct dirent de[8];
+  struct dirinfo di[NELEM(de)];
+  struct stat st;
+  int i, j, m, tot;
 
-  if(f->readable == 0)
+  if(f->type != FD_INODE || f->readable == 0)
     return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
-      return -1;
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
+  for(tot = 0; tot < n; tot += m){
+    // Take the next few entries from the directory, then
+    // look at their inodes with it unlocked, since one of
+    // them may be its parent.
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    // read() may have left the offset inside a dirent.
+    if(f->ip->type != T_DIR || f->off % sizeof(de[0]) != 0){
+      iunlock(f->ip);
+      return -1;
+    }
+    for(m = 0; m < NELEM(de) && tot + m < n && f->off < f->ip->size; f->off += sizeof(de[0])){
+      if(readi(f->ip, 0, (uint64)&de[m], f->off, sizeof(de[0])) != sizeof(de[0])){
+        iunlock(f->ip);
+        return -1;
+      }
+      if(de[m].inum != 0)
+        m++;
+    }
     iunlock(f->ip);
-  } else {
-    panic("fileread");
+    if(m == 0)
+      break;
+
+    begin_op();
+    for(i = j = 0; i < m; i++){
+      // skip entries whose inode was freed since.
+      if(istat(f->ip->dev, de[i].inum, &st) < 0)
+        continue;
+      di[j].ino = st.ino;
+      di[j].type = st.type;
+      di[j].nlink = st.nlink;
+      di[j].size = st.size;
+      memmove(di[j].name, de[i].name, DIRSIZ);
+      di[j].name[DIRSIZ] = 0;
+      j++;
+    }
+    end_op();
+    if(copyout(p->pagetable, addr + tot*sizeof(di[0]), (char*)di, j*sizeof(di[0])) < 0)
+      return -1;
+    m = j;
   }
+  return tot;
+}
+
+// Copy up to n bytes from in, starting at its offset, to
+// out, as sendfile(). The data goes through a kernel page
+// rather than user memory. Returns the number of bytes copied.
+int
+filecopy(struct file *out, struct file *in, int n)
+{
+  struct iovec iov;
+  char *page;
+  int r = 0, m, tot;
+
+  if(in->type != FD_INODE || in->readable == 0 || out->writable == 0)
+    return -1;
+  if((page = kalloc()) == 0)
+    return -1;
+
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    ilock(in->ip);
+    if((r = readi(in->ip, 0, (uint64)page, in->off, m)) > 0)
+      in->off += r;
+    iunlock(in->ip);
+    if(r <= 0)
+      break;
+    iov.base = page;
+    iov.len = r;
+    if((m = filewritev(out, 0, &iov, 1, 0)) != r){
+      // leave in's offset after just the bytes written.
+      if(m < 0)
+        m = 0;
+      ilock(in->ip);
+      in->off -= r - m;
+      iunlock(in->ip);
+      tot += m;
+      r = -1;
+      break;
+    }
+  }
+  kfree(page);
+
+  if(r < 0 && tot == 0)
+    return -1;
+  return tot;
+}
+
+// Give f's file disk blocks for its first n bytes, as
+// fallocate().
+int
+fileprealloc(struct file *f, uint n)
+{
+  int r;
 
+  if(f->type != FD_INODE || f->writable == 0)
+    return -1;
+
+  begin_opn(preallociblocks());
+  ilock(f->ip);
+  r = iprealloc(f->ip, n);
+  iunlock(f->ip);
+  end_op();
   return r;
 }
 
-// Write to file f.
+// Move f's offset, as lseek(). There are no holes in files,
+// so it can't go past the end; in a directory it must stay
+// on an entry boundary.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int r;
+
+  if(f->type != FD_INODE)
+    return -1;
+
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    r = off;
+  else if(whence == SEEK_CUR)
+    r = f->off + off;
+  else if(whence == SEEK_END)
+    r = f->ip->size + off;
+  else
+    r = -1;
+  if(r < 0 || r > f->ip->size ||
+     (f->ip->type == T_DIR && r % sizeof(struct dirent) != 0))
+    r = -1;
+  else
+    f->off = r;
+  iunlock(f->ip);
+  return r;
+}
+
+// Read from file f into the cnt user buffers in iov[],
+// filling each before moving on to the next. Reads at
+// *off if off is non-zero (inodes only), else at f->off.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r = 0, tot = 0;
+  uint64 addr;
+
+  if(f->readable == 0)
+    return -1;
+  if(off && f->type != FD_INODE)
+    return -1;
+
+  if(f->type == FD_INODE)
+    ilock(f->ip);
+  for(i = 0; i < cnt; i++){
+    addr = (uint64)iov[i].base;
+    if(f->type == FD_PIPE){
+      r = piperead(f->pipe, addr, iov[i].len);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+        return -1;
+      r = devsw[f->major].read(1, addr, iov[i].len);
+    } else if(f->type == FD_INODE){
+      if(off){
+        if((r = readi(f->ip, 1, addr, *off, iov[i].len)) > 0)
+          *off += r;
+      } else if((r = readi(f->ip, 1, addr, f->off, iov[i].len)) > 0)
+        f->off += r;
+    } else {
+      panic("fileread");
+    }
+    if(r < 0)
+      break;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  if(f->type == FD_INODE)
+    iunlock(f->ip);
+
+  if(r < 0 && tot == 0)
+    return -1;
+  return tot;
+}
+
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1, 0);
+}
+
+// Write the cnt buffers in iov[] to file f, one after the
+// other; they are user addresses if user_src is 1. Writes
+// at *off if off is non-zero (inodes only), else at f->off,
+// or at the end of the file if f was opened O_APPEND; each
+// chunk is appended atomically. Returns the number of bytes
+// written, which is less than asked for if an error or a
+// full disk stopped the write part way, or -1 if none were.
+int
+filewritev(struct file *f, int user_src, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r, n, n1, m, len, done, ret = 0;
+  uint64 addr;
 
   if(f->writable == 0)
     return -1;
+  if(off && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(1, addr, n);
+  n = 0;
+  for(i = 0; i < cnt; i++)
+    n += iov[i].len;
+
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    for(i = 0; i < cnt; i++){
+      addr = (uint64)iov[i].base;
+      if(f->type == FD_PIPE){
+        r = pipewrite(f->pipe, user_src, addr, iov[i].len);
+      } else {
+        if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+          return -1;
+        r = devsw[f->major].write(user_src, addr, iov[i].len);
+      }
+      if(r < 0)
+        return ret ? ret : -1;
+      ret += r;
+      if(r != iov[i].len)
+        break;
+    }
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
+    // write a chunk at a time, reserving log space for
+    // just that chunk, and leaving room in the maximum
+    // log transaction for other FS system calls. The
+    // buffers land back to back in the file, so a chunk
+    // can span several of them in one transaction.
+    int max = ((LOGBLOCKS/2 - 1 - 1 - 2) / 2) * BSIZE;
+    uint *pos = off ? off : &f->off;
+    i = 0;
+    done = 0;
+    while(ret < n){
+      n1 = n - ret;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_opn(writeiblocks(n1));
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      if(off == 0 && f->append)
+        f->off = f->ip->size;
+      for(m = 0; m < n1; m += r){
+        while(done == iov[i].len){
+          i++;
+          done = 0;
+        }
+        len = iov[i].len - done;
+        if(len > n1 - m)
+          len = n1 - m;
+        if((r = writei(f->ip, user_src, (uint64)iov[i].base + done, *pos, len)) < 0)
+          r = 0;
+        *pos += r;
+        done += r;
+        if(r != len){
+          m += r;
+          break;
+        }
+      }
       iunlock(f->ip);
       end_op();
 
-      if(r != n1){
+      ret += m;
+      if(m != n1){
         // error from writei
+        if(ret == 0)
+          ret = -1;
         break;
       }
-      i += r;
     }
-    ret = (i == n ? n : -1);
   } else {
     panic("filewrite");
   }
@@ -178,3 +456,14 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return filewritev(f, 1, &iov, 1, 0);
+}
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char append;       // FD_INODE: writes go at the end
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -18,6 +19,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // next in hash bucket
+  struct inode *prev;   // LRU list of unreferenced inodes
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +30,18 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  uint dstart;        // file block number of the first delayed block
+  uint ndelay;        // number of delayed blocks, waiting for iflush()
+  char *delay[NDELAY]; // their data, in kalloc()ed pages
+  union {
+    uint addrs[NDIRECT+1];
+    struct {
+      struct extent ext[NEXTENT];
+      uint extblock;
+    };
+    uchar data[NINLINE];
+  };
 };
 
 // map major device number to device functions.
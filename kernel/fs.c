@@ -22,11 +22,31 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+// Most block groups a file system may have.
+#define MAXGROUPS 64
+
+// In-memory summary of the free maps and inodes, built at boot,
+// so balloc() can skip full groups without reading their free
+// maps and ialloc() can pick a group for a new directory.
+// Like sb, there's one for the one device.
+struct {
+  struct spinlock lock;
+  uint nfree[MAXGROUPS];   // free blocks per group
+  uint nifree[MAXGROUPS];  // free inodes per group
+  uint cursor[MAXGROUPS];  // bits before this one are all in use
+  uint navail;             // free blocks not reserved or being allocated
+} freemap;
+
 // Read the super block.
+static void freeinit(int);
+static void dinit(void);
+static void dpurge(uint, uint);
+
 static void
 readsb(int dev, struct superblock *sb)
 {
@@ -44,64 +64,285 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  freeinit(dev);
   ireclaim(dev);
 }
 
-// Zero a block.
+// Zero a block. A block of file data is written
+// in place rather than logged.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Number of blocks in group g.
+static uint
+glen(uint g)
+{
+  return min(sb.bpg, sb.size - GSTART(g, sb));
+}
+
+// Count the free blocks and inodes of each group.
+static void
+freeinit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint g, bi, inum;
+
+  initlock(&freemap.lock, "freemap");
+  if(sb.ngroups > MAXGROUPS || sb.bpg > BPB)
+    panic("freeinit: bad groups");
+  freemap.navail = 0;
+  for(g = 0; g < sb.ngroups; g++){
+    freemap.nfree[g] = 0;
+    freemap.cursor[g] = glen(g);
+    bp = bread(dev, GSTART(g, sb));
+    for(bi = 0; bi < glen(g); bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+        freemap.nfree[g]++;
+        freemap.cursor[g] = min(freemap.cursor[g], bi);
+      }
+    }
+    brelse(bp);
+    freemap.navail += freemap.nfree[g];
+
+    freemap.nifree[g] = 0;
+    for(inum = g * sb.ipg; inum < (g + 1) * sb.ipg; inum++){
+      if(inum == 0)
+        continue;
+      bp = bread(dev, IBLOCK(inum, sb));
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(dip->type == 0)
+        freemap.nifree[g]++;
+      brelse(bp);
+    }
+  }
+}
+
+// Return the first clear bit in map between lo and hi,
+// or -1. Skips a 64-bit word of allocated blocks at a time.
+static int
+firstfree(uchar *map, int lo, int hi)
+{
+  uint64 *w = (uint64*)map;
+  int bi;
+
+  for(bi = lo; bi < hi; bi++){
+    while(bi % 64 == 0 && bi + 64 <= hi && w[bi/64] == ~0ULL)
+      bi += 64;
+    if(bi >= hi)
+      break;
+    if((map[bi/8] & (1 << (bi % 8))) == 0)
+      return bi;
+  }
+  return -1;
+}
+
+// Find a free block in group g's free map: goal if it is
+// free; otherwise, since another file is probably growing
+// there, the start of 64 or else 8 free blocks, so that the
+// two don't interleave; otherwise any free block after goal.
+// Returns -1 if there is none.
+static int
+gfind(uint g, uchar *map, int goal)
+{
+  uint64 *w = (uint64*)map;
+  int bi, hi;
+
+  hi = glen(g);
+  if(goal < hi && (map[goal/8] & (1 << (goal % 8))) == 0)
+    return goal;
+  goal = max(goal, (int)freemap.cursor[g]);
+  for(bi = (goal + 63) / 64 * 64; bi + 64 <= hi; bi += 64){
+    if(w[bi/64] == 0)
+      return bi;
+  }
+  for(bi = (goal + 7) / 8 * 8; bi + 8 <= hi; bi += 8){
+    if(map[bi/8] == 0)
+      return bi;
+  }
+  return firstfree(map, goal, hi);
+}
+
+// Allocate up to *n free blocks in a row, as close to block
+// goal as possible, or the first group if goal is 0, wrapping
+// around the disk once. Sets *n to the number allocated. The
+// blocks aren't zeroed. If reserved is set, the caller has
+// reserved the blocks with breserve(); otherwise blocks that
+// others have reserved are left alone.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+ballocn(uint dev, uint goal, uint *n, int reserved)
 {
-  int b, bi, m;
+  uint g, g0, i, got;
+  int bi, lo;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+  if(!reserved){
+    acquire(&freemap.lock);
+    *n = min(*n, freemap.navail);
+    freemap.navail -= *n;
+    release(&freemap.lock);
+  }
+  got = 0;
+  if(*n == 0)
+    goto out;
+  if(goal < sb.groupstart || goal >= sb.size)
+    goal = sb.groupstart;
+  g0 = BGROUP(goal, sb);
+  lo = BBIT(goal, sb);
+  // one extra visit to the first group, for the
+  // part before the goal.
+  for(i = 0; i <= sb.ngroups; i++, lo = 0){
+    g = (g0 + i) % sb.ngroups;
+    if(freemap.nfree[g] == 0)
+      continue;
+    bp = bread(dev, GSTART(g, sb));
+    bi = gfind(g, bp->data, lo);
+    if(bi >= 0){
+      // Mark the block and the free ones after it in use.
+      while(got < *n && bi + got < glen(g) &&
+            (bp->data[(bi+got)/8] & (1 << ((bi+got) % 8))) == 0){
+        bp->data[(bi+got)/8] |= 1 << ((bi+got) % 8);
+        got++;
       }
+      log_write(bp);
+      acquire(&freemap.lock);
+      freemap.nfree[g] -= got;
+      if(bi == freemap.cursor[g])
+        freemap.cursor[g] += got;
+      release(&freemap.lock);
+      brelse(bp);
+      break;
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
-  return 0;
+
+out:
+  if(!reserved){
+    acquire(&freemap.lock);
+    freemap.navail += *n - got;
+    release(&freemap.lock);
+  }
+  *n = got;
+  if(got == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  return GSTART(g, sb) + bi;
+}
+
+// Allocate a zeroed disk block, to hold file data
+// if data is set, metadata otherwise, near block goal.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, int data, uint goal)
+{
+  uint b, n;
+
+  n = 1;
+  b = ballocn(dev, goal, &n, 0);
+  if(b)
+    bzero(dev, b, data);
+  return b;
+}
+
+// Set aside n free blocks for later ballocn()s, so that
+// data accepted now is sure to have somewhere to go.
+// returns 0, setting aside none, if there aren't that many.
+static int
+breserve(uint n)
+{
+  int ok;
+
+  acquire(&freemap.lock);
+  ok = freemap.navail >= n;
+  if(ok)
+    freemap.navail -= n;
+  release(&freemap.lock);
+  return ok;
+}
+
+// Give back n reserved blocks.
+static void
+bunreserve(uint n)
+{
+  acquire(&freemap.lock);
+  freemap.navail += n;
+  release(&freemap.lock);
+}
+
+// Is block b shared by more than one file?
+static int
+bshared(int dev, uint b)
+{
+  struct buf *bp;
+  int r;
+
+  bp = bread(dev, RBLOCK(b, sb));
+  r = bp->data[RBYTE(b, sb)] != 0;
+  brelse(bp);
+  return r;
+}
+
+// Add delta to the number of files sharing block b.
+// returns 0, changing nothing, if the count would overflow.
+static int
+bref(int dev, uint b, int delta)
+{
+  struct buf *bp;
+  int r;
+
+  bp = bread(dev, RBLOCK(b, sb));
+  r = bp->data[RBYTE(b, sb)] + delta;
+  if(r < 0)
+    panic("bref");
+  if(r <= 0xff){
+    bp->data[RBYTE(b, sb)] = r;
+    log_write(bp);
+  }
+  brelse(bp);
+  return r <= 0xff;
 }
 
-// Free a disk block.
+// Free a disk block, or if other files share it,
+// just drop one file's reference to it.
 static void
 bfree(int dev, uint b)
 {
   struct buf *bp;
   int bi, m;
 
+  if(bshared(dev, b)){
+    bref(dev, b, -1);
+    return;
+  }
+
   bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
+  bi = BBIT(b, sb);
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  acquire(&freemap.lock);
+  freemap.nfree[BGROUP(b, sb)]++;
+  freemap.navail++;
+  if(bi < freemap.cursor[BGROUP(b, sb)])
+    freemap.cursor[BGROUP(b, sb)] = bi;
+  release(&freemap.lock);
   brelse(bp);
 }
 
@@ -112,9 +353,9 @@ bfree(int dev, uint b)
 // its size, the number of links referring to it, and the
 // list of blocks holding the file's content.
 //
-// The inodes are laid out sequentially on disk at block
-// sb.inodestart. Each inode has a number, indicating its
-// position on the disk.
+// The inodes are laid out sequentially on disk, sb.ipg of
+// them after the free map of each block group. Each inode
+// has a number, indicating its position on the disk.
 //
 // The kernel keeps a table of in-use inodes in memory
 // to provide a place for synchronizing access
@@ -131,17 +372,19 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
+//   can be recycled if ip->ref is zero. Otherwise ip->ref
+//   tracks the number of in-memory pointers to the entry
+//   (open files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
 //   decrements ref.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, while iput() clears ip->valid if it frees
+//   the inode. An entry whose ref falls to zero stays
+//   valid, so that iget() of the same inode soon after
+//   doesn't have to read it again.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -165,55 +408,159 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is a hash table of entries keyed by dev and inum,
+// and an LRU list of the entries with ref zero, which iget()
+// recycles when it needs an entry. Entries are kalloc()ed a
+// page at a time; there are at least NINODE of them, and more
+// when that many are in use at once.
+//
+// Each bucket's spin-lock protects its chain and the ref of
+// the entries in it, so iget() of a cached inode and most
+// iput()s only take that lock. itable.lock protects the LRU
+// list and the pool; changing an entry's ref to or from zero,
+// or which inode it holds, takes itable.lock and then the
+// bucket's lock. One must hold a lock covering an entry to
+// use its ip->ref, ip->dev, or ip->inum.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, and the list links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;
+};
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct ibucket bucket[NIHASH];
+  struct inode lru;    // lru.next is most recently used, lru.prev least
+  int n;               // entries in the pool
 } itable;
 
+#define IPP (PGSIZE / sizeof(struct inode))  // entries per page
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  for(i = 0; i < NIHASH; i++) {
+    initlock(&itable.bucket[i].lock, "ibucket");
   }
+  itable.lru.prev = &itable.lru;
+  itable.lru.next = &itable.lru;
+  dinit();
+}
+
+static struct ibucket*
+ibucket(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 31 + inum) % NIHASH];
+}
+
+// Take ip off the LRU list. Caller holds itable.lock.
+static void
+lru_remove(struct inode *ip)
+{
+  ip->prev->next = ip->next;
+  ip->next->prev = ip->prev;
+}
+
+// Put ip on the LRU list, as the most recently used entry if
+// front is set, and the least otherwise. Caller holds
+// itable.lock.
+static void
+lru_insert(struct inode *ip, int front)
+{
+  struct inode *at = front ? &itable.lru : itable.lru.prev;
+
+  ip->next = at->next;
+  ip->prev = at;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
+// Add a page of entries to the pool, at the cold end of the
+// LRU list. Caller holds itable.lock.
+// returns 0 if out of memory.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  int i;
+
+  if((ip = kalloc()) == 0)
+    return 0;
+  memset(ip, 0, PGSIZE);
+  for(i = 0; i < IPP; i++, ip++){
+    initsleeplock(&ip->lock, "inode");
+    lru_insert(ip, 0);
+  }
+  itable.n += IPP;
+  return 1;
 }
 
 static struct inode* iget(uint dev, uint inum);
 
-// Allocate an inode on device dev.
+// Pick a block group for a new directory: of the groups with
+// at least the average number of free inodes, the one with the
+// most free blocks, so that directory trees spread out.
+static uint
+dirgroup(void)
+{
+  uint g, best, avg;
+
+  avg = 0;
+  for(g = 0; g < sb.ngroups; g++)
+    avg += freemap.nifree[g];
+  avg /= sb.ngroups;
+  best = 0;
+  for(g = 0; g < sb.ngroups; g++){
+    if(freemap.nifree[g] == 0 || freemap.nifree[g] < avg)
+      continue;
+    if(freemap.nifree[best] == 0 || freemap.nifree[best] < avg ||
+       freemap.nfree[g] > freemap.nfree[best])
+      best = g;
+  }
+  return best;
+}
+
+// Allocate an inode on device dev, for an entry in
+// directory parent. Files go in parent's block group,
+// or the next one with a free inode.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
 // or NULL if there is no free inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint parent)
 {
-  int inum;
+  uint inum, g, n;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
+  g = type == T_DIR ? dirgroup() : IGROUP(parent, sb);
+  for(n = 0; n < sb.ngroups; n++, g = (g + 1) % sb.ngroups){
+    if(freemap.nifree[g] == 0)
+      continue;
+    for(inum = max(g * sb.ipg, 1); inum < (g + 1) * sb.ipg; inum++){
+      bp = bread(dev, IBLOCK(inum, sb));
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        if(type == T_FILE)
+          dip->flags = I_EXTENTS | I_INLINE;
+        log_write(bp);   // mark it allocated on the disk
+        acquire(&freemap.lock);
+        freemap.nifree[g]--;
+        release(&freemap.lock);
+        brelse(bp);
+        return iget(dev, inum);
+      }
       brelse(bp);
-      return iget(dev, inum);
     }
-    brelse(bp);
   }
   printf("ialloc: no inodes\n");
   return 0;
@@ -235,7 +582,9 @@ iupdate(struct inode *ip)
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
+  // delayed blocks don't have disk blocks yet.
+  dip->size = ip->ndelay ? min(ip->size, ip->dstart * BSIZE) : ip->size;
+  dip->flags = ip->flags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -247,31 +596,64 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct ibucket *bk, *obk;
+  struct inode *ip, **pp;
 
-  acquire(&itable.lock);
+  bk = ibucket(dev, inum);
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  // Is the inode already in use? Then just take
+  // another reference.
+  acquire(&bk->lock);
+  for(ip = bk->head; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum && ip->ref > 0){
       ip->ref++;
-      release(&itable.lock);
+      release(&bk->lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
+  release(&bk->lock);
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  acquire(&itable.lock);
+  acquire(&bk->lock);
+  for(ip = bk->head; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      // Cached, perhaps still valid.
+      if(ip->ref++ == 0)
+        lru_remove(ip);
+      release(&bk->lock);
+      release(&itable.lock);
+      return ip;
+    }
+  }
+  release(&bk->lock);
+
+  // Recycle the least recently used entry, unless that
+  // would throw away a cached inode while the pool is small.
+  ip = itable.lru.prev;
+  if(ip == &itable.lru || (ip->valid && itable.n < NINODE)){
+    if(!igrow())
+      panic("iget: no inodes");
+    ip = itable.lru.prev;
+  }
+  lru_remove(ip);
+  if(ip->inum != 0){
+    // Take it out of its old bucket.
+    obk = ibucket(ip->dev, ip->inum);
+    acquire(&obk->lock);
+    for(pp = &obk->head; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+    release(&obk->lock);
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
-  ip->ref = 1;
   ip->valid = 0;
+  acquire(&bk->lock);
+  ip->ref = 1;
+  ip->hnext = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
   release(&itable.lock);
 
   return ip;
@@ -282,16 +664,19 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ibucket(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
 // Lock the given inode.
 // Reads the inode from disk if necessary.
-void
-ilock(struct inode *ip)
+// Returns -1, leaving ip unlocked, if it is free on the disk.
+static int
+iload(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
@@ -309,12 +694,25 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->flags = dip->flags;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    if(ip->type == 0){
+      releasesleep(&ip->lock);
+      return -1;
+    }
     ip->valid = 1;
-    if(ip->type == 0)
-      panic("ilock: no type");
   }
+  return 0;
+}
+
+// Lock the given inode.
+// Reads the inode from disk if necessary.
+void
+ilock(struct inode *ip)
+{
+  if(iload(ip) < 0)
+    panic("ilock: no type");
 }
 
 // Unlock the given inode.
@@ -337,8 +735,22 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct ibucket *bk = ibucket(ip->dev, ip->inum);
+
+  // Not the last reference?
+  acquire(&bk->lock);
+  if(ip->ref > 1){
+    ip->ref--;
+    release(&bk->lock);
+    return;
+  }
+  release(&bk->lock);
+
   acquire(&itable.lock);
 
+  if(ip->ref == 1 && ip->ndelay && ip->nlink > 0)
+    panic("iput: delayed blocks");
+
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
 
@@ -349,16 +761,26 @@ iput(struct inode *ip)
     release(&itable.lock);
 
     itrunc(ip);
+    if(ip->type == T_DIR)
+      dpurge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
+    acquire(&freemap.lock);
+    freemap.nifree[IGROUP(ip->inum, sb)]++;
+    release(&freemap.lock);
 
     releasesleep(&ip->lock);
 
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  acquire(&bk->lock);
+  if(--ip->ref == 0){
+    // keep it cached, unless it no longer holds an inode.
+    lru_insert(ip, ip->valid);
+  }
+  release(&bk->lock);
   release(&itable.lock);
 }
 
@@ -397,20 +819,517 @@ ireclaim(int dev)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. Only directories are
+// mapped this way, and a hashed directory has at most
+// NDIRINDEX+1 blocks, so a deeper tree is never needed.
+//
+// Regular files (I_EXTENTS) instead list runs of contiguous
+// blocks in ip->ext[], in file order, and NBEXTENT more in
+// block ip->extblock once those are used up. Unused extents
+// have len 0. Since balloc() tries to put a file's next block
+// right after its last one, most files need just a few.
+//
+// A regular file starts out I_INLINE, with up to NINLINE bytes
+// of data held in ip->data[] in place of the extents, and so
+// no blocks at all. writei() moves the data to a block once
+// the file grows past that.
+//
+// iprealloc() maps blocks past the end of a regular file, in
+// long runs, so that writes that fill them don't allocate.
+// Since files have no holes, the file's size tells which of
+// its blocks are unwritten, and those are never read.
+//
+// iclone() makes a regular file share another's data blocks,
+// counting the extra references in the group's reference
+// counts. Before writing a shared block, bmap() gives the
+// file a copy of its own (copy-on-write).
+
+// Where balloc() should look for a block to follow block
+// prev of ip's file: right after prev, or if there is no
+// prev, at the first free block of the inode's block group.
+static uint
+bgoal(struct inode *ip, uint prev)
+{
+  uint g;
+
+  if(prev)
+    return prev + 1;
+  g = IGROUP(ip->inum, sb);
+  return GSTART(g, sb) + freemap.cursor[g];
+}
+
+// Allocate a block near goal to hold one of ip's blocks. If
+// full is set, the caller is about to overwrite all of it, so
+// it's neither read nor zeroed on disk: bget() gives it a
+// buffer whose contents don't matter.
+// returns 0 if out of disk space.
+static uint
+bnew(struct inode *ip, uint goal, int full)
+{
+  uint addr, n;
+
+  if(!full)
+    return balloc(ip->dev, ip->type == T_FILE, goal);
+  n = 1;
+  addr = ballocn(ip->dev, goal, &n, 0);
+  if(addr)
+    brelse(bgetblk(ip->dev, addr));
+  return addr;
+}
+
+// Look up block bn of an extent-mapped inode. Also sets *run,
+// if run isn't 0, to the number of blocks from bn to the end
+// of its extent.
+// returns 0 if bn isn't mapped.
+static uint
+emap(struct inode *ip, uint bn, uint *run)
+{
+  struct extent *e;
+  struct buf *bp;
+  uint lbn, addr;
+  int i, n;
+
+  // Look through the extents in the inode,
+  // then those in the extent block.
+  e = ip->ext;
+  n = NEXTENT;
+  bp = 0;
+  addr = 0;
+  lbn = 0;  // file block number of e[i]
+  for(i = 0; ; i++){
+    if(i == n){
+      if(bp != 0 || ip->extblock == 0)
+        break;
+      bp = bread(ip->dev, ip->extblock);
+      e = (struct extent*)bp->data;
+      n = NBEXTENT;
+      i = 0;
+    }
+    if(e[i].len == 0)
+      break;
+    if(bn < lbn + e[i].len){
+      addr = e[i].start + (bn - lbn);
+      if(run)
+        *run = e[i].len - (bn - lbn);
+      break;
+    }
+    lbn += e[i].len;
+  }
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Map the n blocks starting at addr as file blocks bn and on
+// of an extent-mapped inode. Files don't have holes, so bn
+// must be the block after the last mapped one. The blocks
+// extend the last extent if they land right after it, and
+// otherwise start a new one.
+// returns 0 if out of disk space or extents.
+static int
+eappend(struct inode *ip, uint bn, uint addr, uint len)
+{
+  struct extent *e, *last;
+  struct buf *bp, *lastbp;
+  uint lbn;
+  int i, n, ok;
+
+  e = ip->ext;
+  n = NEXTENT;
+  bp = lastbp = 0;
+  last = 0;
+  lbn = 0;
+  for(i = 0; ; i++){
+    if(i == n){
+      if(bp != 0 || ip->extblock == 0)
+        break;
+      bp = bread(ip->dev, ip->extblock);
+      e = (struct extent*)bp->data;
+      n = NBEXTENT;
+      i = 0;
+    }
+    if(e[i].len == 0)
+      break;
+    lbn += e[i].len;
+    last = &e[i];
+    lastbp = bp;
+  }
+  if(bn != lbn)
+    panic("eappend: hole");
+
+  ok = 1;
+  if(last && addr == last->start + last->len){
+    last->len += len;
+    if(lastbp)
+      log_write(lastbp);
+  } else if(i < n){
+    e[i].start = addr;
+    e[i].len = len;
+    if(bp)
+      log_write(bp);
+  } else if(bp == 0){
+    // The inode's extents are used up; start the extent block.
+    ip->extblock = balloc(ip->dev, 0, addr + len);
+    if(ip->extblock == 0)
+      return 0;
+    bp = bread(ip->dev, ip->extblock);
+    e = (struct extent*)bp->data;
+    e[0].start = addr;
+    e[0].len = len;
+    log_write(bp);
+  } else {
+    printf("eappend: out of extents\n");
+    ok = 0;
+  }
+  if(bp)
+    brelse(bp);
+  return ok;
+}
+
+// Return extent i of an extent-mapped inode, from ip->ext[]
+// or else from the extent block, which is read into *bp the
+// first time. The caller brelse()s *bp if it's set.
+static struct extent*
+eptr(struct inode *ip, int i, struct buf **bp)
+{
+  if(i < NEXTENT)
+    return &ip->ext[i];
+  if(*bp == 0)
+    *bp = bread(ip->dev, ip->extblock);
+  return (struct extent*)(*bp)->data + (i - NEXTENT);
+}
+
+// Free the blocks of an extent-mapped inode past its first
+// nb, and its extent block if that no longer lists any.
+static void
+eshrink(struct inode *ip, uint nb)
+{
+  struct extent *e;
+  struct buf *bp;
+  uint lbn, keep, j;
+  int i, empty;
+
+  bp = 0;
+  lbn = 0;
+  for(i = 0; i < NEXTENT + (ip->extblock ? NBEXTENT : 0); i++){
+    e = eptr(ip, i, &bp);
+    if(e->len == 0)
+      break;
+    lbn += e->len;
+    if(lbn <= nb)
+      continue;
+    keep = e->len - min(e->len, lbn - nb);
+    for(j = keep; j < e->len; j++)
+      bfree(ip->dev, e->start + j);
+    e->len = keep;
+    if(keep == 0)
+      e->start = 0;
+    if(i >= NEXTENT)
+      log_write(bp);
+  }
+  empty = ip->extblock && eptr(ip, NEXTENT, &bp)->len == 0;
+  if(bp)
+    brelse(bp);
+  if(empty){
+    bfree(ip->dev, ip->extblock);
+    ip->extblock = 0;
+  }
+}
+
+// Map file block bn of an extent-mapped inode, which must be
+// mapped, to block addr instead. Splits bn's extent in up to
+// three, unless addr can join the extent before or after.
+// returns 0 if out of disk space or extents.
+static int
+eremap(struct inode *ip, uint bn, uint addr)
+{
+  struct extent *e, *prev, *next, x[3];
+  struct buf *bp;
+  uint lbn, k;
+  int i, j, n, nx, d, join;
+
+  // Find bn's extent, i, and count the extents, n.
+  bp = 0;
+  lbn = k = 0;
+  i = -1;
+  for(n = 0; n < NEXTENT + (ip->extblock ? NBEXTENT : 0); n++){
+    e = eptr(ip, n, &bp);
+    if(e->len == 0)
+      break;
+    if(i < 0 && bn < lbn + e->len){
+      i = n;
+      k = bn - lbn;
+    }
+    lbn += e->len;
+  }
+  if(i < 0)
+    panic("eremap");
+  e = eptr(ip, i, &bp);
+  prev = i > 0 ? eptr(ip, i - 1, &bp) : 0;
+  next = i + 1 < n ? eptr(ip, i + 1, &bp) : 0;
+
+  join = 0;
+  if(k == 0 && prev && prev->start + prev->len == addr)
+    join = -1;
+  else if(k == e->len - 1 && next && next->start == addr + 1)
+    join = 1;
+
+  // The extents that replace e.
+  nx = 0;
+  if(k > 0){
+    x[nx].start = e->start;
+    x[nx++].len = k;
+  }
+  if(join == 0){
+    x[nx].start = addr;
+    x[nx++].len = 1;
+  }
+  if(k < e->len - 1){
+    x[nx].start = e->start + k + 1;
+    x[nx++].len = e->len - k - 1;
+  }
+
+  d = nx - 1;
+  if(n + d > NEXTENT + NBEXTENT){
+    printf("eremap: out of extents\n");
+    if(bp)
+      brelse(bp);
+    return 0;
+  }
+  if(n + d > NEXTENT && ip->extblock == 0){
+    if((ip->extblock = balloc(ip->dev, 0, addr)) == 0)
+      return 0;
+  }
+
+  if(join < 0)
+    prev->len++;
+  if(join > 0){
+    next->start--;
+    next->len++;
+  }
+  if(d > 0){
+    for(j = n - 1; j > i; j--)
+      *eptr(ip, j + d, &bp) = *eptr(ip, j, &bp);
+  } else if(d < 0){
+    for(j = i + 1; j < n; j++)
+      *eptr(ip, j + d, &bp) = *eptr(ip, j, &bp);
+    e = eptr(ip, n - 1, &bp);
+    e->start = e->len = 0;
+  }
+  for(j = 0; j < nx; j++)
+    *eptr(ip, i + j, &bp) = x[j];
+
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
+  return 1;
+}
+
+// Add delta to the reference counts of up to *n of ip's
+// blocks, in file order, and set *n to the number changed.
+// returns 0 if it stopped at a count that would overflow.
+static int
+erefs(struct inode *ip, int delta, uint *n)
+{
+  struct extent *e;
+  struct buf *bp;
+  uint j, done;
+  int i, ok;
+
+  bp = 0;
+  done = 0;
+  ok = 1;
+  for(i = 0; i < NEXTENT + (ip->extblock ? NBEXTENT : 0) && ok; i++){
+    e = eptr(ip, i, &bp);
+    if(e->len == 0)
+      break;
+    for(j = 0; j < e->len && done < *n; j++, done++){
+      if(!bref(ip->dev, e->start + j, delta)){
+        ok = 0;
+        break;
+      }
+    }
+  }
+  if(bp)
+    brelse(bp);
+  *n = done;
+  return ok;
+}
+
+// Give ip its own copy of block addr, its file block bn,
+// which it shares with other files: allocate a block, copy
+// the data unless the caller will overwrite all of it (full),
+// map it in addr's place, and drop ip's reference to addr.
+// returns 0 if out of disk space or extents.
+static uint
+bunshare(struct inode *ip, uint bn, uint addr, int full)
+{
+  struct buf *bp, *obp;
+  uint b, n;
+
+  n = 1;
+  b = ballocn(ip->dev, bgoal(ip, bn > 0 ? emap(ip, bn - 1, 0) : 0), &n, 0);
+  if(b == 0)
+    return 0;
+  if(!eremap(ip, bn, b)){
+    bfree(ip->dev, b);
+    return 0;
+  }
+  bp = bgetblk(ip->dev, b);
+  if(!full){
+    obp = bread(ip->dev, addr);
+    memmove(bp->data, obp->data, BSIZE);
+    brelse(obp);
+  }
+  log_data(bp);
+  brelse(bp);
+  bfree(ip->dev, addr);
+  return b;
+}
+
+// Delayed allocation
+//
+// writei() doesn't allocate disk blocks for data appended to
+// a regular file. It keeps up to NDELAY such blocks in pages
+// hung off the inode, file blocks ip->dstart and on, and
+// reserves disk space for them with breserve() so that a
+// later allocation can't fail for lack of space. iflush()
+// allocates all of them at once, as one run if it can, and
+// writes them straight to their new blocks: they are never
+// zeroed through the log first. Until then the inode on disk
+// doesn't count them in its size.
+
+#define DPP (PGSIZE / BSIZE)  // delayed blocks per page; divides NDELAY
+
+// Return ip's delayed data for file block bn, or 0 if
+// bn isn't delayed.
+static char*
+idelayed(struct inode *ip, uint bn)
+{
+  if(ip->ndelay == 0 || bn < ip->dstart || bn >= ip->dstart + ip->ndelay)
+    return 0;
+  return ip->delay[bn - ip->dstart];
+}
+
+// Start a zeroed delayed block for file block bn, which
+// must be the block after the last mapped or delayed one.
+// Flushes ip's delayed blocks first if there are NDELAY.
+// Caller must hold ip->lock and be in a transaction.
+// returns 0 if out of memory or disk space.
+static char*
+idelay(struct inode *ip, uint bn)
+{
+  char *d;
+  uint i, j;
+
+  if(ip->ndelay == NDELAY && iflush(ip) < 0)
+    return 0;
+  if(ip->ndelay == 0)
+    ip->dstart = bn;
+  else if(bn != ip->dstart + ip->ndelay)
+    panic("idelay: hole");
+  if(!breserve(1))
+    return 0;
+  i = ip->ndelay;
+  if(ip->delay[i] == 0){
+    if((d = kalloc()) == 0){
+      bunreserve(1);
+      return 0;
+    }
+    for(j = 0; j < DPP; j++)
+      ip->delay[i + j] = d + j * BSIZE;
+  }
+  ip->ndelay++;
+  d = idelayed(ip, bn);
+  memset(d, 0, BSIZE);
+  return d;
+}
+
+// Drop ip's delayed blocks and give back their reservations.
+static void
+idrop(struct inode *ip)
+{
+  int i;
+
+  bunreserve(ip->ndelay);
+  ip->ndelay = 0;
+  for(i = 0; i < NDELAY; i++){
+    if(i % DPP == 0 && ip->delay[i])
+      kfree(ip->delay[i]);
+    ip->delay[i] = 0;
+  }
+}
+
+// Allocate disk blocks for ip's delayed blocks, right after
+// the file's last block if possible, and write the data to
+// them. Caller must hold ip->lock and be in a transaction
+// with room for writeiblocks(NDELAY*BSIZE).
+// returns -1 if some of the data had to be dropped, in which
+// case the file ends at the last block written.
+int
+iflush(struct inode *ip)
+{
+  struct buf *bp;
+  uint i, j, n, nd, bn, addr, used;
+
+  nd = ip->ndelay;
+  if(nd == 0)
+    return 0;
+  used = 0;  // reservations used up
+  for(i = 0; i < nd; i += n){
+    bn = ip->dstart + i;
+    n = nd - i;
+    addr = ballocn(ip->dev, bgoal(ip, bn > 0 ? emap(ip, bn - 1, 0) : 0), &n, 1);
+    used += n;
+    if(addr == 0 || !eappend(ip, bn, addr, n)){
+      for(j = 0; j < n; j++)
+        bfree(ip->dev, addr + j);
+      break;
+    }
+    for(j = 0; j < n; j++){
+      bp = bgetblk(ip->dev, addr + j);
+      memmove(bp->data, idelayed(ip, bn + j), BSIZE);
+      log_data(bp);
+      brelse(bp);
+    }
+  }
+  if(i < nd){
+    printf("iflush: dropped %d blocks of inode %d\n", nd - i, ip->inum);
+    ip->size = min(ip->size, (ip->dstart + i) * BSIZE);
+  }
+  ip->ndelay = nd - used;
+  idrop(ip);
+  iupdate(ip);
+  return i < nd ? -1 : 0;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, except in
+// extent-mapped inodes, whose blocks iflush() allocates.
+// Callers that will overwrite the whole block set full, so
+// that a new block isn't zeroed first. Only writei() asks
+// for the blocks of extent-mapped inodes, so bmap() gives
+// the inode its own copy of a shared block.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int full)
 {
   uint addr, *a;
   struct buf *bp;
 
+  if(ip->flags & I_INLINE)
+    panic("bmap: inline");
+  if(ip->flags & I_EXTENTS){
+    addr = emap(ip, bn, 0);
+    if(addr && bshared(ip->dev, addr))
+      addr = bunshare(ip, bn, addr, full);
+    return addr;
+  }
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = bnew(ip, bgoal(ip, bn > 0 ? ip->addrs[bn-1] : 0), full);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -422,7 +1341,7 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, 0, bgoal(ip, ip->addrs[NDIRECT-1]));
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
@@ -430,7 +1349,7 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = bnew(ip, bgoal(ip, bn > 0 ? a[bn-1] : ip->addrs[NDIRECT]), full);
       if(addr){
         a[bn] = addr;
         log_write(bp);
@@ -451,6 +1370,37 @@ itrunc(struct inode *ip)
   int i, j;
   struct buf *bp;
   uint *a;
+  struct extent *e;
+
+  if(ip->flags & I_INLINE){
+    memset(ip->data, 0, NINLINE);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
+  if(ip->flags & I_EXTENTS){
+    idrop(ip);
+    for(i = 0; i < NEXTENT; i++){
+      for(j = 0; j < ip->ext[i].len; j++)
+        bfree(ip->dev, ip->ext[i].start + j);
+    }
+    if(ip->extblock){
+      bp = bread(ip->dev, ip->extblock);
+      e = (struct extent*)bp->data;
+      for(i = 0; i < NBEXTENT; i++){
+        for(j = 0; j < e[i].len; j++)
+          bfree(ip->dev, e[i].start + j);
+      }
+      brelse(bp);
+      bfree(ip->dev, ip->extblock);
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->flags |= I_INLINE;
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -475,6 +1425,194 @@ itrunc(struct inode *ip)
   iupdate(ip);
 }
 
+// Move the data of an I_INLINE inode to a block of its own,
+// so that the file can grow past NINLINE bytes. The block is
+// allocated now rather than delayed, since the data is already
+// on disk in the inode.
+// returns -1 if out of disk space.
+static int
+iunline(struct inode *ip)
+{
+  uchar data[NINLINE];
+  struct buf *bp;
+  uint addr, n;
+
+  memmove(data, ip->data, NINLINE);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->flags &= ~I_INLINE;
+  if(ip->size == 0)
+    return 0;
+
+  n = 1;
+  if((addr = ballocn(ip->dev, bgoal(ip, 0), &n, 0)) == 0)
+    goto bad;
+  if(!eappend(ip, 0, addr, 1)){
+    bfree(ip->dev, addr);
+    goto bad;
+  }
+  bp = bgetblk(ip->dev, addr);
+  memset(bp->data, 0, BSIZE);
+  memmove(bp->data, data, ip->size);
+  log_data(bp);
+  brelse(bp);
+  return 0;
+
+bad:
+  memmove(ip->data, data, NINLINE);
+  ip->flags |= I_INLINE;
+  return -1;
+}
+
+// Upper bound on the number of distinct blocks iprealloc()
+// logs: those of flushing and unlining the inode, the free
+// map blocks, and the extent block and its free map block.
+int
+preallociblocks(void)
+{
+  return writeiblocks(0) + sb.ngroups + 3;
+}
+
+// Give regular file ip disk blocks for its first n bytes, as
+// few runs of them as possible, past those it has. The blocks
+// aren't written or zeroed, and ip's size doesn't change.
+// Caller must hold ip->lock and be in a transaction with room
+// for preallociblocks().
+// returns -1 if ip isn't a regular file or if out of disk
+// space or extents, in which case the file keeps just the
+// blocks it had.
+int
+iprealloc(struct inode *ip, uint n)
+{
+  struct extent *e;
+  struct buf *bp;
+  uint bn, bn0, nb, addr, got, left, j;
+  int i;
+
+  if(ip->type != T_FILE || !(ip->flags & I_EXTENTS))
+    return -1;
+  if((ip->flags & I_INLINE) && iunline(ip) < 0)
+    return -1;
+  if(iflush(ip) < 0)
+    return -1;
+
+  // Count the blocks already mapped.
+  bp = 0;
+  bn = 0;
+  for(i = 0; i < NEXTENT + (ip->extblock ? NBEXTENT : 0); i++){
+    e = eptr(ip, i, &bp);
+    if(e->len == 0)
+      break;
+    bn += e->len;
+  }
+  if(bp)
+    brelse(bp);
+
+  // Set aside all the blocks first, so that a call asking
+  // for more than the disk has takes none of them.
+  nb = n / BSIZE + (n % BSIZE != 0);
+  left = nb > bn ? nb - bn : 0;
+  bn0 = bn;
+  if(breserve(left)){
+    for(; bn < nb; bn += got){
+      got = nb - bn;
+      addr = ballocn(ip->dev, bgoal(ip, bn > 0 ? emap(ip, bn - 1, 0) : 0), &got, 1);
+      if(addr == 0)
+        break;
+      left -= got;
+      if(!eappend(ip, bn, addr, got)){
+        for(j = 0; j < got; j++)
+          bfree(ip->dev, addr + j);
+        break;
+      }
+    }
+    bunreserve(left);
+  }
+  if(bn < nb)
+    eshrink(ip, bn0);
+  iupdate(ip);
+  return bn < nb ? -1 : 0;
+}
+
+// Upper bound on the number of distinct blocks iclone() logs:
+// those of flushing the source's delayed blocks and of freeing
+// the clone's old blocks, the reference count blocks, the
+// clone's extent block and the free map block recording it,
+// and the inodes. It grows with the number of block groups,
+// and may be more than one transaction can hold.
+int
+cloneiblocks(void)
+{
+  return writeiblocks(0) + sb.ngroups * (1 + 2*NREFB(sb)) + 4;
+}
+
+// Make regular file np a clone of regular file ip: discard
+// np's contents and have it share ip's data blocks, which
+// bmap() copies before either file writes them. Locks ip
+// and then np, never both at once. Must be called inside
+// a transaction with room for cloneiblocks().
+// returns -1 if they aren't different regular files, if
+// ip's blocks are already shared too many times, or if out
+// of disk space.
+int
+iclone(struct inode *ip, struct inode *np)
+{
+  struct dinode d;
+  struct buf *bp, *nbp;
+  uint n;
+  int r;
+
+  if(ip == np)
+    return -1;
+  ilock(np);
+  r = np->type == T_FILE ? 0 : -1;
+  iunlock(np);
+  if(r < 0)
+    return -1;
+
+  // Count np's references to ip's blocks, and copy the
+  // inode's block map, with np getting its own extent block.
+  ilock(ip);
+  r = -1;
+  if(ip->type != T_FILE || !(ip->flags & I_EXTENTS) || iflush(ip) < 0)
+    goto out;
+  d.flags = ip->flags;
+  d.size = ip->size;
+  memmove(d.data, ip->data, NINLINE);
+  if(!(ip->flags & I_INLINE)){
+    if(ip->extblock){
+      if((d.extblock = balloc(ip->dev, 0, ip->extblock)) == 0)
+        goto out;
+      bp = bread(ip->dev, ip->extblock);
+      nbp = bread(ip->dev, d.extblock);
+      memmove(nbp->data, bp->data, BSIZE);
+      log_write(nbp);
+      brelse(nbp);
+      brelse(bp);
+    }
+    n = ~0;
+    if(!erefs(ip, 1, &n)){
+      erefs(ip, -1, &n);
+      if(d.extblock)
+        bfree(ip->dev, d.extblock);
+      goto out;
+    }
+  }
+  r = 0;
+out:
+  iunlock(ip);
+  if(r < 0)
+    return -1;
+
+  ilock(np);
+  itrunc(np);
+  np->flags = d.flags;
+  np->size = d.size;
+  memmove(np->data, d.data, NINLINE);
+  iupdate(np);
+  iunlock(np);
+  return 0;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -487,6 +1625,25 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Copy stat information from inode inum on device dev.
+// Returns -1 if the inode has been freed, as it may be
+// by the time a caller that read inum from a directory
+// gets here. Must be called inside a transaction, like iput().
+int
+istat(uint dev, uint inum, struct stat *st)
+{
+  struct inode *ip;
+
+  ip = iget(dev, inum);
+  if(iload(ip) < 0){
+    iput(ip);
+    return -1;
+  }
+  stati(ip, st);
+  iunlockput(ip);
+  return 0;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -494,20 +1651,49 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, bn, addr, run, ra;
   struct buf *bp;
+  char *d;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->flags & I_INLINE){
+    if(either_copyout(user_dst, dst, ip->data + off, n) == -1)
+      return -1;
+    return n;
+  }
+
+  ra = 0;  // blocks before ra have been read ahead
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    bn = off/BSIZE;
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if((d = idelayed(ip, bn)) != 0){
+      if(either_copyout(user_dst, dst, d + (off % BSIZE), m) == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    run = 1;
+    if(ip->flags & I_EXTENTS)
+      addr = emap(ip, bn, &run);
+    else
+      addr = bmap(ip, bn, 0);
     if(addr == 0)
       break;
+    if(bn >= ra && run > 1){
+      // Read the part of the extent that this read
+      // covers with one batch of disk requests.
+      run = min(run, (off + n - tot - 1)/BSIZE - bn + 1);
+      run = min(run, NDISKBATCH);
+      if(run > 1)
+        breadahead(ip->dev, addr, run);
+      ra = bn + run;
+    }
     bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -518,6 +1704,22 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Upper bound on the number of distinct blocks writei()
+// logs or pins when writing n bytes: the data blocks, plus
+// the NDELAY delayed ones it may flush, the bitmap blocks
+// recording their allocation, the reference count blocks of
+// shared blocks it copies, the inode's block, and the
+// indirect block or the extent block. Lets
+// callers reserve log space with begin_opn() before they
+// lock the inode.
+int
+writeiblocks(uint n)
+{
+  int nb = n/BSIZE + 2 + NDELAY;  // a misaligned write touches one more block
+  return nb + min(nb, sb.ngroups) + min(nb, sb.ngroups * NREFB(sb)) +
+    2;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -528,31 +1730,68 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, bn, addr, unwritten;
   struct buf *bp;
+  char *d;
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(!(ip->flags & I_EXTENTS) && off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->flags & I_INLINE){
+    if(off + n <= NINLINE){
+      if(either_copyin(ip->data + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(iunline(ip) < 0)
+      return -1;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    bn = off/BSIZE;
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if(ip->flags & I_EXTENTS){
+      // new blocks wait in memory for iflush().
+      if((d = idelayed(ip, bn)) == 0 && emap(ip, bn, 0) == 0)
+        d = idelay(ip, bn);
+      if(d != 0){
+        if(either_copyin(d + (off % BSIZE), user_src, src, m) == -1)
+          break;
+        if(off + m > ip->size)
+          ip->size = off + m;
+        continue;
+      }
+    }
+    // a block past the end of the file was preallocated and
+    // holds nothing yet, so there's no need to read it.
+    unwritten = (ip->flags & I_EXTENTS) && bn * BSIZE >= ip->size;
+    addr = bmap(ip, bn, m == BSIZE || unwritten);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
+    if(unwritten){
+      bp = bgetblk(ip->dev, addr);
+      memset(bp->data, 0, BSIZE);
+    } else {
+      bp = bread(ip->dev, addr);
+    }
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ip->type == T_FILE)
+      log_data(bp);  // file data bypasses the log
+    else
+      log_write(bp);
     brelse(bp);
+    if(off + m > ip->size)
+      ip->size = off + m;
   }
 
-  if(off > ip->size)
-    ip->size = off;
-
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
   // block to ip->addrs[].
@@ -569,32 +1808,401 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache
+//
+// dirlookup() remembers which inode a name in a directory
+// refers to, or that the directory has no such name (inum 0),
+// so that looking the name up again doesn't read the
+// directory. dirlink() and dirunlink() keep the entries of a
+// directory up to date, and iput() drops them when it frees
+// the directory. The directory's ip->lock serializes changes
+// to its entries; dcache.lock protects the table itself.
+
+struct dentry {
+  uint dev;
+  uint dir;             // inum of the directory, or 0 if unused
+  char name[DIRSIZ];
+  uint inum;            // inode the name refers to, or 0
+  uint off;             // offset of its dirent in dir
+  struct dentry *hnext; // next in hash bucket
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *bucket[NDHASH];
+  struct dentry lru;    // lru.next is most recently used, lru.prev least
+} dcache;
+
+static void
+dinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = &dcache.lru;
+  dcache.lru.next = &dcache.lru;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+static struct dentry**
+dbucket(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return &dcache.bucket[h % NDHASH];
+}
+
+// Move d to the front (or back) of the LRU list.
+static void
+dtouch(struct dentry *d, int front)
+{
+  struct dentry *at = front ? &dcache.lru : dcache.lru.prev;
+
+  d->prev->next = d->next;
+  d->next->prev = d->prev;
+  if(at == d)
+    at = d->prev;
+  d->next = at->next;
+  d->prev = at;
+  at->next->prev = d;
+  at->next = d;
+}
+
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dbucket(d->dev, d->dir, d->name); *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+}
+
+// Find the entry for name in directory dir.
+// Caller must hold dcache.lock.
+static struct dentry*
+dget(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dbucket(dev, dir, name); d; d = d->hnext){
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0){
+      dtouch(d, 1);
+      return d;
+    }
+  }
+  return 0;
+}
+
+// Record that name in directory dir refers to inode inum,
+// with its dirent at off, or that there's no such name if
+// inum is 0.
+static void
+dset(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  struct dentry **bk;
+
+  acquire(&dcache.lock);
+  if((d = dget(dev, dir, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.lru.prev;
+    if(d->dir)
+      dunhash(d);
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    bk = dbucket(dev, dir, name);
+    d->hnext = *bk;
+    *bk = d;
+    dtouch(d, 1);
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Drop all the entries of directory dir, which is being freed.
+static void
+dpurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    if(d->dev == dev && d->dir == dir){
+      dunhash(d);
+      dtouch(d, 0);
+    }
+  }
+  release(&dcache.lock);
+}
+
+// Hashed directories
+//
+// A directory whose first block fills up is turned into a
+// hashed one (see struct dirindex in fs.h), so that looking
+// up or adding a name reads just block 0 and one leaf, rather
+// than every block. Directories that were already longer
+// stay linear.
+
+// FNV-1a hash of a name.
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Return the file block number of the leaf of hashed
+// directory dp that holds name, or 0 for "." and "..", which
+// are in block 0. Sets *pi, if pi isn't 0, to the leaf's
+// index entry.
+static uint
+dirleaf(struct inode *dp, char *name, int *pi)
+{
+  struct buf *bp;
+  struct dirindex *ix;
+  uint h, fbn;
+  int i;
+
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+    return 0;
+  h = dirhash(name);
+  bp = bread(dp->dev, bmap(dp, 0, 0));
+  ix = (struct dirindex*)bp->data + 2;
+  for(i = 0; i+1 < NDIRINDEX && ix[i+1].block && ix[i+1].hash <= h; i++)
+    ;
+  fbn = ix[i].block;
+  brelse(bp);
+  if(pi)
+    *pi = i;
+  return fbn;
+}
+
+// Directories are read a block at a time, looking at all
+// the dirents in a block while holding its buffer, rather
+// than with a readi() per dirent.
+
+// Number of dirents of directory dp in block fbn.
+static int
+dirents(struct inode *dp, uint fbn)
+{
+  return min(DPB, (dp->size - fbn*BSIZE) / sizeof(struct dirent));
+}
+
+// Look for name in block fbn of directory dp. Returns its
+// inode number and sets *poff to its byte offset, or returns
+// 0 if it isn't there.
+static uint
+dirscan(struct inode *dp, uint fbn, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint inum;
+  int i, n;
+
+  bp = bread(dp->dev, bmap(dp, fbn, 0));
+  de = (struct dirent*)bp->data;
+  n = dirents(dp, fbn);
+  inum = 0;
+  for(i = 0; i < n; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      inum = de[i].inum;
+      *poff = fbn*BSIZE + i*sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Return the byte offset of a free dirent in block fbn of
+// directory dp, or -1 if there is none.
+static int
+dirfree(struct inode *dp, uint fbn)
+{
+  struct buf *bp;
+  struct dirent *de;
+  int i, n;
+
+  bp = bread(dp->dev, bmap(dp, fbn, 0));
+  de = (struct dirent*)bp->data;
+  n = dirents(dp, fbn);
+  for(i = 0; i < n; i++)
+    if(de[i].inum == 0)
+      break;
+  brelse(bp);
+  return i < n ? fbn*BSIZE + i*sizeof(*de) : -1;
+}
+
+// Turn linear directory dp, whose one block is full, into a
+// hashed directory: block 0 keeps "." and "..", and the other
+// entries move to a leaf in block 1.
+// returns -1 if out of disk space, or "." and ".." aren't in
+// the usual place.
+static int
+dirhashify(struct inode *dp)
+{
+  struct buf *b0, *b1;
+  struct dirent *de;
+  struct dirindex *ix;
+  uint addr;
+
+  b0 = bread(dp->dev, bmap(dp, 0, 0));
+  de = (struct dirent*)b0->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0 ||
+     (addr = bmap(dp, 1, 1)) == 0){
+    brelse(b0);
+    return -1;
+  }
+  b1 = bread(dp->dev, addr);
+  memmove(b1->data, b0->data, BSIZE);
+  memset(b1->data, 0, 2*sizeof(*de));
+  memset(b0->data + 2*sizeof(*de), 0, BSIZE - 2*sizeof(*de));
+  ix = (struct dirindex*)b0->data + 2;
+  ix[0].hash = 0;
+  ix[0].block = 1;
+  log_write(b1);
+  log_write(b0);
+  brelse(b1);
+  brelse(b0);
+
+  dp->flags |= I_DIRHASH;
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+  dpurge(dp->dev, dp->inum);  // the entries moved
+  return 0;
+}
+
+// Split full leaf i of hashed directory dp in two, moving the
+// entries with the upper half of the hashes to a new leaf at
+// the end of the directory.
+// returns -1 if the index is full, the names in the leaf all
+// hash alike, or out of disk space.
+static int
+dirsplit(struct inode *dp, int i)
+{
+  struct buf *ib, *ob, *nb;
+  struct dirindex *ix;
+  struct dirent *ode, *nde;
+  uint h[DPB], key, t, fbn, addr;
+  int j, k, n;
+
+  ib = bread(dp->dev, bmap(dp, 0, 0));
+  ix = (struct dirindex*)ib->data + 2;
+  if(ix[NDIRINDEX-1].block != 0){
+    brelse(ib);
+    return -1;
+  }
+  ob = bread(dp->dev, bmap(dp, ix[i].block, 0));
+  ode = (struct dirent*)ob->data;
+
+  // The new leaf starts at the median hash, or if that's the
+  // smallest, at the next larger one.
+  n = 0;
+  for(j = 0; j < DPB; j++){
+    if(ode[j].inum == 0)
+      continue;
+    t = dirhash(ode[j].name);
+    for(k = n++; k > 0 && h[k-1] > t; k--)
+      h[k] = h[k-1];
+    h[k] = t;
+  }
+  for(j = n/2; j < n && h[j] == h[0]; j++)
+    ;
+  fbn = dp->size / BSIZE;
+  if(j == n || (addr = bmap(dp, fbn, 1)) == 0){
+    brelse(ob);
+    brelse(ib);
+    return -1;
+  }
+  key = h[j];
+
+  nb = bread(dp->dev, addr);
+  memset(nb->data, 0, BSIZE);
+  nde = (struct dirent*)nb->data;
+  for(j = k = 0; j < DPB; j++){
+    if(ode[j].inum != 0 && dirhash(ode[j].name) >= key){
+      nde[k++] = ode[j];
+      memset(&ode[j], 0, sizeof(ode[j]));
+    }
+  }
+  memmove(&ix[i+2], &ix[i+1], (NDIRINDEX - i - 2) * sizeof(*ix));
+  ix[i+1].hash = key;
+  ix[i+1].block = fbn;
+  log_write(nb);
+  log_write(ob);
+  log_write(ib);
+  brelse(nb);
+  brelse(ob);
+  brelse(ib);
+
+  dp->size += BSIZE;
+  iupdate(dp);
+  dpurge(dp->dev, dp->inum);  // the entries moved
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint off, inum, fbn;
+  struct dentry *d;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  acquire(&dcache.lock);
+  if((d = dget(dp->dev, dp->inum, name)) != 0){
+    inum = d->inum;
+    off = d->off;
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  release(&dcache.lock);
+
+  inum = 0;
+  if(dp->flags & I_DIRHASH){
+    // only one block can hold name.
+    inum = dirscan(dp, dirleaf(dp, name, 0), name, &off);
+  } else {
+    for(fbn = 0; fbn*BSIZE < dp->size && inum == 0; fbn++)
+      inum = dirscan(dp, fbn, name, &off);
   }
 
-  return 0;
+  if(inum == 0){
+    dset(dp->dev, dp->inum, name, 0, 0);
+    return 0;
+  }
+  if(poff)
+    *poff = off;
+  dset(dp->dev, dp->inum, name, inum, off);
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -602,7 +2210,8 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  int off, i;
+  uint fbn;
   struct dirent de;
   struct inode *ip;
 
@@ -612,22 +2221,52 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(!(dp->flags & I_DIRHASH)){
+    // Look for an empty dirent, or else add one at the end.
+    off = -1;
+    for(fbn = 0; fbn*BSIZE < dp->size && off < 0; fbn++)
+      off = dirfree(dp, fbn);
+    if(off < 0)
+      off = dp->size;
+    // Rather than grow past one block, become hashed.
+    if(off == BSIZE && dp->size == BSIZE)
+      dirhashify(dp);
+  }
+
+  if(dp->flags & I_DIRHASH){
+    // Look in the leaf for name, splitting it if full.
+    for(;;){
+      if((fbn = dirleaf(dp, name, &i)) == 0)
+        return -1;
+      if((off = dirfree(dp, fbn)) >= 0)
+        break;
+      if(dirsplit(dp, i) < 0)
+        return -1;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dset(dp->dev, dp->inum, name, inum, off);
 
   return 0;
 }
 
+// Remove the directory entry for name, at offset off,
+// from directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("unlink: writei");
+  dset(dp->dev, dp->inum, name, 0, 0);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -6,8 +6,14 @@
 #define BSIZE 1024  // block size
 
 // Disk layout:
-// [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+// [ boot block | super block | log | block group 0 | block group 1 | ... ]
+//
+// Each block group holds:
+// [ free bit map | reference counts | inode blocks | data blocks ]
+// so that the kernel can keep a file's blocks together and
+// near its inode. The reference counts have a byte for each
+// block of the group: the number of files sharing the block
+// beyond the first, so 0 for most blocks.
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -18,15 +24,34 @@ struct superblock {
   uint ninodes;      // Number of inodes.
   uint nlog;         // Number of log blocks
   uint logstart;     // Block number of first log block
-  uint inodestart;   // Block number of first inode block
-  uint bmapstart;    // Block number of first free map block
+  uint groupstart;   // Block number of first block group
+  uint ngroups;      // Number of block groups
+  uint bpg;          // Blocks per group, at most BPB (the last may be short)
+  uint ipg;          // Inodes per group, a multiple of IPB
 };
 
-#define FSMAGIC 0x10203040
+#define FSMAGIC 0x10203043
 
-#define NDIRECT 12
+#define NDIRECT 27
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT)  // blocks of a block-mapped inode
+
+// A run of len consecutive blocks of a file, held in
+// consecutive disk blocks starting at block start.
+struct extent {
+  uint start;
+  uint len;
+};
+
+#define NEXTENT 13                                // extents in an inode
+#define NBEXTENT (BSIZE / sizeof(struct extent))  // extents in an extent block
+
+#define NINLINE ((NDIRECT+1) * sizeof(uint))  // bytes of data an inode holds itself
+
+// Inode flags
+#define I_EXTENTS 0x1  // data blocks are mapped by ext[], not addrs[]
+#define I_INLINE  0x2  // the data is in data[], and there are no data blocks
+#define I_DIRHASH 0x4  // directory is hashed, see struct dirindex
 
 // On-disk inode structure
 struct dinode {
@@ -35,20 +60,52 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // I_EXTENTS, I_INLINE, I_DIRHASH
+  union {
+    uint addrs[NDIRECT+1];   // Data block addresses
+    struct {
+      struct extent ext[NEXTENT];  // Data blocks, in file order
+      uint extblock;               // Block of NBEXTENT more extents, or 0
+    };
+    uchar data[NINLINE];     // Data of an I_INLINE inode
+  };
 };
 
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
-// Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
-
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
+// First block of block group g
+#define GSTART(g, sb) ((g) * sb.bpg + sb.groupstart)
+
+// Block group containing block b
+#define BGROUP(b, sb) (((b) - sb.groupstart) / sb.bpg)
+
+// Block group containing inode i
+#define IGROUP(i, sb) ((i) / sb.ipg)
+
+// Reference count blocks per block group
+#define NREFB(sb)     ((sb.bpg + BSIZE - 1) / BSIZE)
+
+// First data block of block group g
+#define GDATA(g, sb)  (GSTART(g, sb) + 1 + NREFB(sb) + sb.ipg / IPB)
+
+// Block containing inode i
+#define IBLOCK(i, sb) (GSTART(IGROUP(i, sb), sb) + 1 + NREFB(sb) + (i) % sb.ipg / IPB)
+
 // Block of free map containing bit for block b
-#define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
+#define BBLOCK(b, sb) GSTART(BGROUP(b, sb), sb)
+
+// Bit for block b in its free map block
+#define BBIT(b, sb)   (((b) - sb.groupstart) % sb.bpg)
+
+// Block of reference counts containing block b's
+#define RBLOCK(b, sb) (BBLOCK(b, sb) + 1 + BBIT(b, sb) / BSIZE)
+
+// Byte for block b in its reference count block
+#define RBYTE(b, sb)  (BBIT(b, sb) % BSIZE)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
@@ -60,3 +117,32 @@ struct dirent {
   char name[DIRSIZ] __attribute__((nonstring));
 };
 
+#define DPB (BSIZE / sizeof(struct dirent))  // dirents per block
+
+// A directory entry with the stat of its inode, as returned
+// by getdents().
+struct dirinfo {
+  uint ino;             // Inode number
+  short type;           // Type of file
+  short nlink;          // Number of links to file
+  uint64 size;          // Size of file in bytes
+  char name[DIRSIZ+1];  // NUL-terminated
+};
+
+// A hashed directory (I_DIRHASH) keeps "." and ".." in the first
+// two dirents of block 0, and an index in the rest of block 0.
+// Index entry i lists leaf block i, which holds the entries whose
+// names hash to at least its hash and less than the next one's.
+// Index entries are sorted by hash; unused ones have block 0.
+// Their inum field is 0, so code that reads the directory as an
+// array of dirents skips them.
+struct dirindex {
+  ushort zero;  // 0, where a dirent has inum
+  ushort pad;
+  uint hash;    // least name hash in the leaf
+  uint block;   // file block number of the leaf
+  uint pad2;
+};
+
+#define NDIRINDEX (DPB - 2)  // leaves of a hashed directory
+
@@ -3,9 +3,11 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -16,39 +18,142 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves MAXOPBLOCKS of log
+// space for the call; begin_opn(n) reserves just n, for calls
+// that know how much they will write. Usually begin_opn() just
+// adds the reservation to the in-progress FS system calls and
+// returns. But if it thinks the log is close to running out, it
+// sleeps until the last outstanding end_op() commits, or, if no
+// call is outstanding, installs the committed blocks to make room.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
+// The on-disk log holds a sequence of transactions, each
+// of which is:
 //   header block, containing block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The header also holds a commit sequence number and a checksum
+// over the header and the logged blocks. A commit writes the
+// blocks and the header in one pass; if a crash leaves any of them
+// unwritten, the checksum doesn't match and recovery ignores the
+// transaction.
+//
+// Checkpointing is lazy. After a commit the modified blocks stay
+// pinned in the buffer cache, and the next transaction is appended
+// after the previous one. Only when the log doesn't have room for
+// another FS system call are all the committed blocks installed at
+// their home locations, each once no matter how many transactions
+// modified it, and the log restarts at its beginning with an empty
+// header. Recovery replays the chain of transactions starting at the
+// beginning of the log, stopping at the first header that doesn't
+// checksum or doesn't carry the next sequence number, and then
+// clears the log the same way, so that a boot after everything has
+// been installed replays nothing.
+//
+// File data doesn't go through the log (ordered mode). log_data()
+// pins a data block, and commit() writes it to its home location
+// before writing the transaction, so after a crash the metadata
+// never refers to data blocks that weren't written.
+//
+// A hash index of the blocks pinned for the log, those in the
+// running transaction and those committed but not yet installed,
+// lets log_write() detect absorption without scanning the log.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  uint seq;    // commit sequence number
+  uint cksum;  // checksum over the header and the logged blocks
   int block[LOGBLOCKS];
 };
 
+// Size of the hash index of pinned blocks. A power of two,
+// and more than twice the number of blocks that can be pinned.
+#define NLOGINDEX 1024
+
+struct logent {
+  uint blockno;  // 0 if the entry is unused
+  short tx;      // index in lh.block[], or -1
+  short dirty;   // committed but not yet installed?
+};
+
 struct log {
   struct spinlock lock;
   int start;
+  int size;        // blocks in the on-disk log
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by the executing calls
   int committing;  // in commit(), please wait.
+  int forcing;     // log_sync() is waiting for the running transaction
+  uint ncommit;    // calls to commit() finished
   int dev;
+  uint seq;        // sequence number of the next commit
+  int head;        // where in the log the next commit goes
+  int ndirty;      // committed blocks not yet installed
+  int dirty[MAXLOGSIZE];
+  int ndata;       // file data blocks to write before the commit
+  struct buf *data[LOGBLOCKS];
+  struct logent index[NLOGINDEX];
+  struct logstat stat;
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void clear_head(void);
+
+// FNV-1a, a word at a time.
+static uint
+cksum(uint h, void *p, int n)
+{
+  uint *w = (uint*)p;
+  int i;
+
+  for(i = 0; i < n/sizeof(uint); i++)
+    h = (h ^ w[i]) * 16777619;
+  return h;
+}
+
+// Checksum of the header fields, excluding cksum itself.
+static uint
+cksum_head(struct logheader *lh)
+{
+  uint h = 2166136261;
+
+  h = cksum(h, &lh->n, sizeof(lh->n));
+  h = cksum(h, &lh->seq, sizeof(lh->seq));
+  h = cksum(h, lh->block, lh->n * sizeof(lh->block[0]));
+  return h;
+}
+
+// Find block b in the index of pinned blocks.
+// If it isn't there and create is set, add it;
+// otherwise return 0.
+static struct logent*
+logent(uint b, int create)
+{
+  struct logent *e;
+  uint i;
+
+  i = (b * 2654435761U) & (NLOGINDEX-1);
+  for(;; i = (i + 1) & (NLOGINDEX-1)){
+    e = &log.index[i];
+    if(e->blockno == b)
+      return e;
+    if(e->blockno == 0)
+      break;
+  }
+  if(!create)
+    return 0;
+  e->blockno = b;
+  e->tx = -1;
+  e->dirty = 0;
+  return e;
+}
 
 void
 initlog(int dev, struct superblock *sb)
@@ -58,58 +163,196 @@ initlog(int dev, struct superblock *sb)
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
+  log.size = sb->nlog;
   log.dev = dev;
+  if (log.size < LOGBLOCKS+1 || log.size > MAXLOGSIZE)
+    panic("initlog: bad log size");
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Read n blocks of the transaction whose header is at
+// offset off, starting with block tail, in one batch.
+static void
+read_log(int off, int tail, int n, struct buf **bs)
+{
+  uint blocknos[NDISKBATCH];
+  int i;
+
+  for (i = 0; i < n; i++)
+    blocknos[i] = log.start+off+tail+i+1;
+  breadv(log.dev, blocknos, n, bs);
+}
+
+// Copy the transaction whose header is at offset off
+// from the log to the blocks' home locations, NDISKBATCH
+// blocks at a time.
 static void
-install_trans(int recovering)
+install_trans(int off)
 {
-  int tail;
+  struct buf *lbufs[NDISKBATCH], *dbufs[NDISKBATCH];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    if(recovering) {
-      printf("recovering tail %d dst %d\n", tail, log.lh.block[tail]);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > NDISKBATCH)
+      n = NDISKBATCH;
+    read_log(off, tail, n, lbufs); // cached by valid_head()
+    for (i = 0; i < n; i++) {
+      dbufs[i] = bgetblk(log.dev, log.lh.block[tail+i]); // no need to read dst
+      memmove(dbufs[i]->data, lbufs[i]->data, BSIZE);  // copy block to dst
+      brelse(lbufs[i]);
     }
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+    bwritev(dbufs, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      brelse(dbufs[i]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Sort n block numbers, so that a batch of buffers is
+// locked in block order, as breadv() callers lock theirs.
 static void
-read_head(void)
+sortblocks(uint *b, int n)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  uint t;
+  int i, j;
+
+  for (i = 1; i < n; i++) {
+    t = b[i];
+    for (j = i; j > 0 && b[j-1] > t; j--)
+      b[j] = b[j-1];
+    b[j] = t;
+  }
+}
+
+// Write the pinned blocks blocknos[0..n-1] from the cache to
+// their home locations in one batch, and unpin them. If ordered
+// is set, only the blocks still queued by log_data() are written.
+static void
+write_pinned(uint *blocknos, int n, int ordered)
+{
+  struct buf *bs[NDISKBATCH], *wr[NDISKBATCH];
+  int i, nwr;
+
+  sortblocks(blocknos, n);
+  breadv(log.dev, blocknos, n, bs); // pinned, so cached
+  nwr = 0;
+  for (i = 0; i < n; i++) {
+    if (!ordered || bs[i]->ordered) {
+      bs[i]->ordered = 0;
+      wr[nwr++] = bs[i];
+    }
+  }
+  if (nwr > 0)
+    bwritev(wr, nwr);
+  if (ordered)
+    log.stat.ordered += nwr;
+  for (i = 0; i < n; i++) {
+    bunpin(bs[i]);
+    brelse(bs[i]);
+  }
+}
+
+// Write all committed blocks from the cache to their
+// home locations, NDISKBATCH blocks at a time, and start
+// the log over.
+static void
+checkpoint(void)
+{
+  uint blocknos[NDISKBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.ndirty; tail += n) {
+    n = log.ndirty - tail;
+    if (n > NDISKBATCH)
+      n = NDISKBATCH;
+    for (i = 0; i < n; i++)
+      blocknos[i] = log.dirty[tail+i];
+    write_pinned(blocknos, n, 0);
+  }
+  log.stat.checkpoints++;
+  log.stat.installed += log.ndirty;
+  log.ndirty = 0;
+  log.head = 0;
+  memset(log.index, 0, sizeof(log.index));
+  clear_head();
+}
+
+// Read the log header at offset off from disk
+// into the in-memory log header.
+static void
+read_head(int off)
+{
+  struct buf *buf = bread(log.dev, log.start+off);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
   log.lh.n = lh->n;
+  log.lh.seq = lh->seq;
+  log.lh.cksum = lh->cksum;
+  if(log.lh.n < 0 || log.lh.n > LOGBLOCKS || off+1+log.lh.n > log.size)
+    log.lh.n = 0;  // torn or garbage header
   for (i = 0; i < log.lh.n; i++) {
     log.lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
-static void
-write_head(void)
+// Is the transaction described by the in-memory header,
+// read from offset off, completely on disk? Recomputes the
+// checksum from the header and the log blocks.
+static int
+valid_head(int off)
+{
+  struct buf *lbufs[NDISKBATCH];
+  uint h;
+  int tail, i, n;
+
+  if(log.lh.n == 0)
+    return 0;
+  h = cksum_head(&log.lh);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > NDISKBATCH)
+      n = NDISKBATCH;
+    read_log(off, tail, n, lbufs);
+    for (i = 0; i < n; i++) {
+      h = cksum(h, lbufs[i]->data, BSIZE);
+      brelse(lbufs[i]);
+    }
+  }
+  return h == log.lh.cksum;
+}
+
+// Return a locked buf holding the in-memory log header,
+// to be written at log.head. Once it and the blocks its
+// checksum covers are all on disk, the current transaction
+// has committed.
+static struct buf*
+head_buf(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bgetblk(log.dev, log.start+log.head);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
   hb->n = log.lh.n;
+  hb->seq = log.lh.seq;
+  hb->cksum = log.lh.cksum;
   for (i = 0; i < log.lh.n; i++) {
     hb->block[i] = log.lh.block[i];
   }
+  return buf;
+}
+
+// Write an empty header at log.head, so that recovery
+// doesn't replay transactions that are already installed.
+// It carries the next sequence number, so that the numbers
+// never go backwards from one boot to the next.
+static void
+clear_head(void)
+{
+  struct buf *buf;
+
+  log.lh.n = 0;
+  log.lh.seq = log.seq;
+  buf = head_buf();
   bwrite(buf);
   brelse(buf);
 }
@@ -117,25 +360,74 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
+  uint64 t0 = r_time();
+  int off = 0, ntrans = 0, nblocks = 0;
+
+  read_head(off);
+  log.seq = log.lh.seq;
+  while(valid_head(off) && log.lh.seq == log.seq){
+    install_trans(off); // committed, copy from log to disk
+    ntrans++;
+    nblocks += log.lh.n;
+    log.seq++;
+    off += 1 + log.lh.n;
+    if(off >= log.size)
+      break;
+    read_head(off);
+  }
   log.lh.n = 0;
-  write_head(); // clear the log
+  log.head = 0;
+  if(ntrans > 0){
+    clear_head();
+    // qemu's timer runs at 10 MHz.
+    printf("recovery: %d blocks from %d transactions in %d ms\n",
+           nblocks, ntrans, (int)((r_time() - t0) / 10000));
+  }
 }
-
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the start of an FS system call that
+// writes at most n distinct blocks.
+void
+begin_opn(int n)
+{
+  if(n > LOGBLOCKS)
+    panic("begin_opn: too big");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGBLOCKS){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.forcing){
+      // let the running transaction drain so it can commit.
+      sleep(&log, &log.lock);
+    } else if(log.lh.n + log.ndata + log.reserved + n > LOGBLOCKS){
+      // this op might overflow the transaction, which also holds
+      // the file data blocks of calls that have ended; wait for commit.
       sleep(&log, &log.lock);
+    } else if(log.head + 1 + log.lh.n + log.reserved + n > log.size){
+      if(log.outstanding > 0){
+        // this op might exhaust log space; wait for commit.
+        sleep(&log, &log.lock);
+      } else {
+        // nothing will commit to make room, but everything
+        // in the cache has been committed: install it.
+        log.committing = 1;
+        release(&log.lock);
+        checkpoint();
+        acquire(&log.lock);
+        log.committing = 0;
+        wakeup(&log);
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
@@ -151,15 +443,17 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
+  myproc()->logres = 0;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
     do_commit = 1;
     log.committing = 1;
+    log.forcing = 0;
   } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+    // begin_opn() may be waiting for log space,
+    // and this call's reservation has been released.
     wakeup(&log);
   }
   release(&log.lock);
@@ -170,36 +464,130 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
+    log.ncommit++;
     wakeup(&log);
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Wait until the FS system calls that have already finished
+// are on disk. Once no call is outstanding the last end_op()
+// has committed them; otherwise hold off new calls so the
+// running transaction drains and commits.
+// Must not be called in a transaction.
+void
+log_sync(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  n = log.ncommit;
+  while((log.outstanding > 0 || log.committing) && log.ncommit == n){
+    if(log.outstanding > 0)
+      log.forcing = 1;
+    sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
+// Copy modified blocks from cache to log, checksumming them
+// on the way, and write them NDISKBATCH at a time. The header
+// goes out with the last batch: the checksum makes it safe for
+// the disk to write them in any order.
 static void
 write_log(void)
 {
-  int tail;
+  struct buf *bufs[NDISKBATCH];
+  uint h;
+  int tail, i, n, last;
+
+  log.lh.seq = log.seq;
+  h = cksum_head(&log.lh);
+  tail = 0;
+  do {
+    for (n = 0; n < NDISKBATCH && tail < log.lh.n; n++, tail++) {
+      struct buf *to = bgetblk(log.dev, log.start+log.head+tail+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+      memmove(to->data, from->data, BSIZE);
+      h = cksum(h, to->data, BSIZE);
+      brelse(from);
+      bufs[n] = to;
+    }
+    last = tail == log.lh.n && n < NDISKBATCH;
+    if (last) {
+      log.lh.cksum = h;
+      bufs[n++] = head_buf();
+    }
+    bwritev(bufs, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(bufs[i]);
+  } while (!last);
+}
+
+// Write the transaction's file data blocks
+// to their home locations, NDISKBATCH at a time.
+static void
+write_data(void)
+{
+  uint blocknos[NDISKBATCH];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.ndata; tail += n) {
+    n = log.ndata - tail;
+    if (n > NDISKBATCH)
+      n = NDISKBATCH;
+    for (i = 0; i < n; i++)
+      blocknos[i] = log.data[tail+i]->blockno;
+    write_pinned(blocknos, n, 1);  // skips blocks logged after all
   }
+  log.ndata = 0;
 }
 
 static void
 commit()
 {
+  int i;
+
+  write_data();      // Write file data in place, ahead of the metadata
   if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+    if (log.head + 1 + log.lh.n > log.size)
+      panic("commit: past end of log");
+    write_log();     // Write modified blocks and checksummed header
+                     // to the log -- completes the commit
+    // The blocks stay pinned until the next checkpoint.
+    for (i = 0; i < log.lh.n; i++) {
+      struct logent *e = logent(log.lh.block[i], 0);
+      e->tx = -1;
+      if (!e->dirty) {
+        e->dirty = 1;
+        log.dirty[log.ndirty++] = log.lh.block[i];
+      }
+    }
+    log.stat.commits++;
+    log.stat.logged += log.lh.n;
+    log.head += 1 + log.lh.n;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.seq++;
+  }
+}
+
+// Add b to the running transaction. Caller holds log.lock.
+static void
+logblock(struct buf *b)
+{
+  struct logent *e;
+
+  e = logent(b->blockno, 1);
+  b->ordered = 0;  // log_data() may have queued it
+  if (e->tx >= 0) {  // log absorption
+    log.stat.absorbed++;
+  } else {  // Add new block to log
+    if (log.head + 1 + log.lh.n + 1 > log.size)
+      panic("log_write: past end of log");  // wrote more than reserved
+    if (!e->dirty)  // not already pinned by an earlier commit?
+      bpin(b);
+    e->tx = log.lh.n;
+    log.lh.block[log.lh.n++] = b->blockno;
   }
 }
 
@@ -215,23 +603,47 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
-
   acquire(&log.lock);
-  if (log.lh.n >= LOGBLOCKS)
+  if (log.lh.n + log.ndata >= LOGBLOCKS)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
+  logblock(b);
+  release(&log.lock);
+}
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
-      break;
-  }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+// Caller has modified file data in b->data and is done with
+// the buffer. Pin it in the cache; commit() will write it to
+// its home location before writing the transaction to the log.
+//
+// A block that is pinned for the log, because it held metadata
+// in a transaction that hasn't been installed yet, is logged
+// instead: otherwise recovery could replay the stale metadata
+// over the data.
+void
+log_data(struct buf *b)
+{
+  acquire(&log.lock);
+  if (log.lh.n + log.ndata >= LOGBLOCKS)
+    panic("too big a transaction");
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+
+  if (logent(b->blockno, 0) != 0) {
+    logblock(b);
+  } else if (!b->ordered) {
+    b->ordered = 1;
     bpin(b);
-    log.lh.n++;
+    log.data[log.ndata++] = b;
   }
   release(&log.lock);
 }
 
+// Copy the log's statistics to *st.
+void
+logstat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
+  release(&log.lock);
+}
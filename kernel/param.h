@@ -2,13 +2,22 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-nodes cached before unused ones are recycled
+#define NIHASH       61  // buckets in the i-node cache
+#define NDENTRY      200 // directory entries cached for path lookup
+#define NDHASH       67  // buckets in the directory entry cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXIOV       16  // max buffers per readv/writev
+#define PIPEPAGES     4  // pages in a new pipe's buffer (a power of two)
+#define PIPEMAXPAGES 16  // max pages in a pipe's buffer
+#define MAXOPBLOCKS  10  // max # of blocks most FS ops write
+#define LOGBLOCKS    128 // max data blocks in one log transaction
+#define MAXLOGSIZE   256 // max blocks in on-disk log
+#define NDISKBATCH   16  // max blocks in one batch of disk requests
+#define NDELAY       16  // max file blocks an inode holds in memory before allocating them
+#define NBUF         (MAXLOGSIZE+LOGBLOCKS+4*NDISKBATCH)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
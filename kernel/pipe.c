@@ -8,17 +8,49 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
-
+// The buffer is a ring of whole pages, size bytes in all.
+// size is a power of two, so nread and nwrite can wrap.
+// Readers and writers copy the longest contiguous run they
+// can, at most up to the end of a page, per copyin/copyout.
+// A writer sleeps only when the ring is full and a reader
+// only when it is empty, so each side wakes the other only
+// when it ends that state.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEMAXPAGES];
+  uint size;      // bytes in data
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static void
+pagesfree(char **pg, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(pg[i])
+      kfree(pg[i]);
+}
+
+// Fill pg[0..n-1] with fresh pages; 0 if out of memory.
+static int
+pagesalloc(char **pg, int n)
+{
+  int i;
+
+  memset(pg, 0, n * sizeof(pg[0]));
+  for(i = 0; i < n; i++){
+    if((pg[i] = kalloc()) == 0){
+      pagesfree(pg, i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,6 +62,12 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if(!pagesalloc(pi->data, PIPEPAGES)){
+    kfree((char*)pi);
+    pi = 0;
+    goto bad;
+  }
+  pi->size = PIPEPAGES*PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -68,15 +106,71 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    pagesfree(pi->data, pi->size / PGSIZE);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Resize pi's buffer to at least n bytes, rounded up to a
+// power-of-two number of pages, keeping what it holds.
+// n == 0 just asks. Returns the size in bytes, or -1 if
+// n is too big or smaller than what's in the pipe now.
+int
+pipesize(struct pipe *pi, int n)
+{
+  char *pg[PIPEMAXPAGES], *old[PIPEMAXPAGES];
+  uint np, onp, cnt, off, m, i;
+
+  if(n < 0 || n > PIPEMAXPAGES*PGSIZE)
+    return -1;
+  if(n == 0){
+    acquire(&pi->lock);
+    n = pi->size;
+    release(&pi->lock);
+    return n;
+  }
+  for(np = 1; np*PGSIZE < n; np *= 2)
+    ;
+  if(!pagesalloc(pg, np))
+    return -1;
+
+  acquire(&pi->lock);
+  cnt = pi->nwrite - pi->nread;
+  if(cnt > np*PGSIZE){
+    release(&pi->lock);
+    pagesfree(pg, np);
+    return -1;
+  }
+  // copy what's in the ring to the start of the new pages.
+  for(i = 0; i < cnt; i += m){
+    off = (pi->nread + i) % pi->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > PGSIZE - i % PGSIZE)
+      m = PGSIZE - i % PGSIZE;
+    if(m > cnt - i)
+      m = cnt - i;
+    memmove(pg[i / PGSIZE] + i % PGSIZE, pi->data[off / PGSIZE] + off % PGSIZE, m);
+  }
+  onp = pi->size / PGSIZE;
+  memmove(old, pi->data, onp * sizeof(old[0]));
+  memmove(pi->data, pg, np * sizeof(pg[0]));
+  if(cnt == pi->size && np*PGSIZE > cnt)
+    wakeup(&pi->nwrite);
+  pi->size = np*PGSIZE;
+  pi->nread = 0;
+  pi->nwrite = cnt;
+  release(&pi->lock);
+
+  pagesfree(old, onp);
+  return np*PGSIZE;
+}
+
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
   int i = 0;
+  uint off, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,18 +179,24 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    if(pi->nwrite == pi->nread + pi->size){ //DOC: pipewrite-full
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      continue;
     }
+    // the free space up to the end of this page.
+    off = pi->nwrite % pi->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > pi->size - (pi->nwrite - pi->nread))
+      m = pi->size - (pi->nwrite - pi->nread);
+    if(m > n - i)
+      m = n - i;
+    if(either_copyin(pi->data[off / PGSIZE] + off % PGSIZE, user_src, addr + i, m) == -1)
+      break;
+    if(pi->nwrite == pi->nread)
+      wakeup(&pi->nread);
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
@@ -106,8 +206,8 @@ int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
+  uint off, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,18 +217,23 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1) {
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    // the bytes up to the end of this page.
+    off = pi->nread % pi->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > n - i)
+      m = n - i;
+    if(copyout(pr->pagetable, addr + i, pi->data[off / PGSIZE] + off % PGSIZE, m) == -1) {
       if(i == 0)
         i = -1;
       break;
     }
-    pi->nread++;
+    if(pi->nwrite == pi->nread + pi->size)  //DOC: piperead-wakeup
+      wakeup(&pi->nwrite);
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
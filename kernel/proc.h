@@ -112,5 +112,6 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  int logres;                  // Log blocks reserved by begin_opn()
   char name[16];               // Process name (debugging)
 };
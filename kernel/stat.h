@@ -9,3 +9,13 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// Log statistics, as returned by logstat().
+struct logstat {
+  uint64 commits;     // transactions committed
+  uint64 logged;      // blocks written to the log
+  uint64 absorbed;    // log_write()s of a block already in the transaction
+  uint64 checkpoints; // times the committed blocks were installed
+  uint64 installed;   // blocks written to their home locations
+  uint64 ordered;     // file data blocks written in place, bypassing the log
+};
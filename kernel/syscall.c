@@ -101,6 +101,19 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_logstat(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_clonefile(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_pipesize(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +139,19 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_logstat] sys_logstat,
+[SYS_getdents] sys_getdents,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_lseek]   sys_lseek,
+[SYS_fsync]   sys_fsync,
+[SYS_sync]    sys_sync,
+[SYS_sendfile] sys_sendfile,
+[SYS_clonefile] sys_clonefile,
+[SYS_fallocate] sys_fallocate,
+[SYS_pipesize] sys_pipesize,
 };
 
 void
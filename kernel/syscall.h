@@ -20,3 +20,16 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_logstat 22
+#define SYS_getdents 23
+#define SYS_pread  24
+#define SYS_pwrite 25
+#define SYS_readv  26
+#define SYS_writev 27
+#define SYS_lseek  28
+#define SYS_fsync  29
+#define SYS_sync   30
+#define SYS_sendfile 31
+#define SYS_clonefile 32
+#define SYS_fallocate 33
+#define SYS_pipesize 34
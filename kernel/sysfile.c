@@ -34,6 +34,30 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
+// Fetch the nth and n+1th system call arguments as a user
+// array of struct iovec and its length, and copy it in.
+static int
+argiov(int n, struct iovec *iov, int *pcnt)
+{
+  uint64 uiov;
+  int i, cnt, tot;
+
+  argaddr(n, &uiov);
+  argint(n+1, &cnt);
+  if(cnt < 0 || cnt > MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, cnt*sizeof(*iov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].len < 0 || iov[i].len > 0x7fffffff - tot)
+      return -1;
+    tot += iov[i].len;
+  }
+  *pcnt = cnt;
+  return 0;
+}
+
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
 static int
@@ -94,6 +118,134 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// read(), but at offset off, leaving the file's own
+// offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+  uint o;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.base = (void*)p;
+  iov.len = n;
+  o = off;
+  return filereadv(f, &iov, 1, &o);
+}
+
+// write(), but at offset off, leaving the file's own
+// offset alone.
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+  uint o;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.base = (void*)p;
+  iov.len = n;
+  o = off;
+  return filewritev(f, 1, &iov, 1, &o);
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, &cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, 0);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, &cnt) < 0)
+    return -1;
+  return filewritev(f, 1, iov, cnt, 0);
+}
+
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+uint64
+sys_sync(void)
+{
+  filesyncall();
+  return 0;
+}
+
+// copy n bytes from file in to file out without
+// passing them through user space.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || n < 0)
+    return -1;
+  return filecopy(out, in, n);
+}
+
+// allocate disk blocks for bytes off through off+len-1
+// of a file, and so for all before them, since files have
+// no holes, without changing its size.
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  argint(1, &off);
+  argint(2, &len);
+  if(argfd(0, 0, &f) < 0 || off < 0 || len <= 0)
+    return -1;
+  return fileprealloc(f, (uint)off + len);
+}
+
 uint64
 sys_close(void)
 {
@@ -119,6 +271,33 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+uint64
+sys_logstat(void)
+{
+  uint64 addr; // user pointer to struct logstat
+  struct logstat st;
+
+  argaddr(0, &addr);
+  logstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  uint64 addr; // user pointer to array of struct dirinfo
+  int n;
+
+  argaddr(1, &addr);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filegetdents(f, addr, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -189,7 +368,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -219,9 +397,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -262,7 +438,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0){
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0){
     iunlockput(dp);
     return 0;
   }
@@ -301,6 +477,46 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
+// Make new a copy of file old that shares its disk
+// blocks until one of the two writes them.
+uint64
+sys_clonefile(void)
+{
+  char new[MAXPATH], old[MAXPATH];
+  struct inode *ip, *np;
+  int r, n;
+
+  if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
+    return -1;
+  if((n = MAXOPBLOCKS + cloneiblocks()) > LOGBLOCKS)
+    return -1;  // too many block groups for one transaction
+
+  begin_opn(n);
+  if((ip = namei(old)) == 0){
+    end_op();
+    return -1;
+  }
+  // check the source before creating the clone.
+  ilock(ip);
+  if(ip->type != T_FILE){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  if((np = create(new, T_FILE, 0, 0)) == 0){
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(np);
+  r = iclone(ip, np);
+  iput(np);
+  iput(ip);
+  end_op();
+  return r;
+}
+
 uint64
 sys_open(void)
 {
@@ -359,6 +575,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->append = (omode & O_APPEND) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -503,3 +720,17 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// set the buffer size of the pipe fd to at least n bytes,
+// or just return it if n is 0.
+uint64
+sys_pipesize(void)
+{
+  struct file *f;
+  int n;
+
+  argint(1, &n);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_PIPE)
+    return -1;
+  return pipesize(f->pipe, n);
+}
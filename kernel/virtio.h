@@ -47,7 +47,9 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// each request uses three, so batched I/O can
+// have NUM/3 requests in flight.
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
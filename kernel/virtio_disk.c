@@ -220,26 +220,30 @@ alloc3_desc(int *idx)
 // requests to the hardware. We inject logic to inspect
 // the request type (Read/Write) and the target sector.
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// hand one request to the device without waiting for it.
+// virtio_disk_intr() frees its descriptors when it completes.
+// caller holds disk.vdisk_lock.
+static void
+virtio_disk_start(struct buf *b, int write)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
-
   //5.1 I/O Inspection Logic
   // We intercept the buffer request 'b' to analyze its properties.
   // This provides real-time observability of the disk subsystem,
   // allowing us to see exactly which blocks are being accessed
-  // during the OS operation.
+  // during the OS operation. It prints a line per request,
+  // so it is only built in with "make DISKMONITOR=1".
 
   //______NEW MONITOR LOGIC______
+#ifdef DISKMONITOR
   const char *op_type = write ? "WRITE" : "READ ";
 
   // We print the operation type and the block number.
   // This demonstrates that the driver is actively processing
   // specific sectors of the virtual disk.
   printf("DISK MONITOR: Op=%s | Block=%d | Sector=%d\n", op_type, b->blockno, (int)sector);
+#endif
   //_____________________________
 
 
@@ -303,14 +307,33 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
-  }
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// read or write n buffers. all the requests are queued before
+// waiting for any, so the device can work on them together
+// instead of one round trip per block.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  int i;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i++)
+    virtio_disk_start(bs[i], write);
+
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(i = 0; i < n; i++){
+    while(bs[i]->disk == 1) {
+      sleep(bs[i], &disk.vdisk_lock);
+    }
+  }
 
   release(&disk.vdisk_lock);
 }
@@ -426,6 +449,9 @@ virtio_disk_intr()
     b->disk = 0;   // disk is done with buf
     wakeup(b);
 
+    disk.info[id].b = 0;
+    free_chain(id);
+
     disk.used_idx += 1;
   }
 
@@ -16,14 +16,18 @@
 #endif
 
 #define NINODES 200
+#define BLOCKSPERGROUP 512
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/BPB + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGBLOCKS+1;   // Header followed by LOGBLOCKS data blocks.
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+// [ boot block | sb block | log | block group 0 | block group 1 | ... ]
+// with each block group
+// [ free bit map | reference counts | inode blocks | data blocks ]
+
+int nlog;     // Number of log blocks, sized to the disk in main()
+int ngroups;  // Number of block groups
+int ipg;      // Inodes per group
+int nrefb;    // Number of reference count blocks per group
+int nmeta;    // Number of meta blocks (boot, sb, nlog, bitmaps, ref counts, inodes)
 int nblocks;  // Number of data blocks
 
 int fsfd;
@@ -32,14 +36,24 @@ char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
+// Root directory entries other than "." and "..".
+struct rootent {
+  uint hash;
+  struct dirent de;
+} rootents[NINODES];
+int nrootents;
+
 
 void balloc(int);
+uint nextblock(void);
+uint emap(struct dinode*, uint);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void wdir(uint inum);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,10 +83,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
+  uint rootino, inum;
   struct dirent de;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -89,23 +102,47 @@ main(int argc, char *argv[])
   if(fsfd < 0)
     die(argv[1]);
 
+  // The log gets an eighth of the disk, at least enough
+  // for one maximal transaction and its header, and no
+  // more than the kernel can keep track of.
+  nlog = FSSIZE / 8;
+  if(nlog < LOGBLOCKS+1)
+    nlog = LOGBLOCKS+1;
+  if(nlog > MAXLOGSIZE)
+    nlog = MAXLOGSIZE;
+
+  // Divide the rest of the disk into block groups, each with
+  // its share of the inodes. The last group may be short.
+  ngroups = (FSSIZE - 2 - nlog + BLOCKSPERGROUP - 1) / BLOCKSPERGROUP;
+  assert(ngroups <= 64);
+  ipg = (NINODES / ngroups + IPB - 1) / IPB * IPB;
+  assert(BLOCKSPERGROUP <= BPB);
+
+  // No blocks are shared yet, so the reference counts
+  // stay zero.
+  nrefb = (BLOCKSPERGROUP + BSIZE - 1) / BSIZE;
+
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nmeta = 2 + nlog + ngroups * (1 + nrefb + ipg / IPB);
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
   sb.size = xint(FSSIZE);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ngroups * ipg);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.groupstart = xint(2+nlog);
+  sb.ngroups = xint(ngroups);
+  sb.bpg = xint(BLOCKSPERGROUP);
+  sb.ipg = xint(ipg);
+  assert(NREFB(sb) == nrefb);
+  assert(GDATA(ngroups-1, sb) < FSSIZE);
 
-  printf("nmeta %d (boot, super, log blocks %u, inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u, %d groups of %d blocks with %d inodes) blocks %d total %d\n",
+         nmeta, nlog, ngroups, BLOCKSPERGROUP, ipg, nblocks, FSSIZE);
 
-  freeblock = nmeta;     // the first free block that we can allocate
+  freeblock = GDATA(0, sb);     // the first free block that we can allocate
 
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
@@ -151,10 +188,11 @@ main(int argc, char *argv[])
     
     inum = ialloc(T_FILE);
 
+    assert(nrootents < NINODES);
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootents[nrootents++].de = de;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -162,12 +200,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino);
 
   balloc(freeblock);
 
@@ -229,28 +262,74 @@ ialloc(ushort type)
   din.type = xshort(type);
   din.nlink = xshort(1);
   din.size = xint(0);
+  if(type == T_FILE)
+    din.flags = xint(I_EXTENTS | I_INLINE);
   winode(inum, &din);
   return inum;
 }
 
+// Allocate the next data block, skipping over
+// the metadata at the start of each block group.
+uint
+nextblock(void)
+{
+  uint b = freeblock;
+
+  if(BBIT(b, sb) == 0)  // reached the next group's free map
+    b = GDATA(BGROUP(b, sb), sb);
+  freeblock = b + 1;
+  assert(b < FSSIZE);
+  return b;
+}
+
+// Write the free maps, marking each group's metadata
+// and the data blocks before block used as in use.
 void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
-
-  printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BPB);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  uint g, b;
+
+  printf("balloc: blocks before %d have been allocated\n", used);
+  for(g = 0; g < ngroups; g++){
+    bzero(buf, BSIZE);
+    for(b = GSTART(g, sb); b < GSTART(g+1, sb) && b < FSSIZE; b++){
+      if(b < GDATA(g, sb) || b < used)
+        buf[BBIT(b, sb)/8] |= 0x1 << (BBIT(b, sb)%8);
+    }
+    wsect(GSTART(g, sb), buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding block fbn of an extent-mapped file,
+// allocating it if fbn is the block after the file's end.
+// Files written here are contiguous except where they cross
+// into another block group, so the inode's extents suffice.
+uint
+emap(struct dinode *dip, uint fbn)
+{
+  uint lbn = 0, b;
+  int i;
+
+  for(i = 0; i < NEXTENT && xint(dip->ext[i].len) > 0; i++){
+    if(fbn < lbn + xint(dip->ext[i].len))
+      return xint(dip->ext[i].start) + fbn - lbn;
+    lbn += xint(dip->ext[i].len);
+  }
+  assert(fbn == lbn);
+  b = nextblock();
+  if(i > 0 && b == xint(dip->ext[i-1].start) + xint(dip->ext[i-1].len)){
+    dip->ext[i-1].len = xint(xint(dip->ext[i-1].len) + 1);
+  } else {
+    assert(i < NEXTENT);
+    dip->ext[i].start = xint(b);
+    dip->ext[i].len = xint(1);
+  }
+  return b;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -264,21 +343,40 @@ iappend(uint inum, void *xp, int n)
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  if(xint(din.flags) & I_INLINE){
+    if(off + n <= NINLINE){
+      bcopy(p, din.data + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // too big to stay inline: move the data to blocks.
+    bcopy(din.data, buf, off);
+    bzero(din.data, NINLINE);
+    din.flags = xint(xint(din.flags) & ~I_INLINE);
+    din.size = xint(0);
+    winode(inum, &din);
+    if(off > 0)
+      iappend(inum, buf, off);
+    rinode(inum, &din);
+  }
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(xint(din.flags) & I_EXTENTS){
+      x = emap(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
+        din.addrs[fbn] = xint(nextblock());
       }
       x = xint(din.addrs[fbn]);
     } else {
+      assert(fbn < MAXFILE);
       if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+        din.addrs[NDIRECT] = xint(nextblock());
       }
       rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
+        indirect[fbn - NDIRECT] = xint(nextblock());
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
@@ -295,6 +393,76 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// FNV-1a hash of a name, as in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+int
+rootentcmp(const void *a, const void *b)
+{
+  uint x = ((struct rootent*)a)->hash, y = ((struct rootent*)b)->hash;
+
+  return x < y ? -1 : x > y;
+}
+
+// Write the root directory's entries after "." and "..":
+// in the rest of its first block if they fit, and otherwise
+// as a hashed directory, with room to grow in each leaf.
+void
+wdir(uint inum)
+{
+  struct dinode din;
+  struct dirindex ix[NDIRINDEX];
+  static struct dirent leaf[NDIRINDEX][DPB];
+  int i, j, nleaf;
+  uint off;
+
+  if(nrootents <= NDIRINDEX){
+    for(i = 0; i < nrootents; i++)
+      iappend(inum, &rootents[i].de, sizeof(struct dirent));
+    // fix size of root inode dir
+    rinode(inum, &din);
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(inum, &din);
+    return;
+  }
+
+  for(i = 0; i < nrootents; i++)
+    rootents[i].hash = dirhash(rootents[i].de.name);
+  qsort(rootents, nrootents, sizeof(rootents[0]), rootentcmp);
+
+  // Fill leaves three quarters full, keeping names that
+  // hash alike in the same leaf.
+  bzero(ix, sizeof(ix));
+  bzero(leaf, sizeof(leaf));
+  nleaf = 0;
+  for(i = 0; i < nrootents; i = j, nleaf++){
+    assert(nleaf < NDIRINDEX);
+    ix[nleaf].hash = xint(nleaf == 0 ? 0 : rootents[i].hash);
+    ix[nleaf].block = xint(nleaf + 1);
+    for(j = i; j < nrootents && (j - i < DPB*3/4 || rootents[j].hash == rootents[j-1].hash); j++){
+      assert(j - i < DPB);
+      leaf[nleaf][j - i] = rootents[j].de;
+    }
+  }
+  iappend(inum, ix, sizeof(ix));
+  for(i = 0; i < nleaf; i++)
+    iappend(inum, leaf[i], sizeof(leaf[i]));
+
+  rinode(inum, &din);
+  din.flags = xint(xint(din.flags) | I_DIRHASH);
+  winode(inum, &din);
+}
+
 void
 die(const char *s)
 {
@@ -123,8 +123,13 @@ def recover_log():
     q = QEMU()
     time.sleep(2)
     q.read()
-    ok, _ = q.match('^recovering', exit=False)
+    ok, line = q.match('^recovery: ', exit=False)
     if ok:
+        m = re.match(r'^recovery: (\d+) blocks from (\d+) transactions in (\d+) ms', line)
+        if not m or int(m.group(1)) == 0 or int(m.group(3)) > 5000:
+            print("FAIL: bad recovery report", line)
+            q.stop()
+            sys.exit(1)
         q.cmd("ls\n")
         time.sleep(2)
         q.read()
@@ -9,6 +9,12 @@ cat(int fd)
 {
   int n;
 
+  // let the kernel do the copying if fd is a file.
+  while((n = sendfile(1, fd, 8192)) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
@@ -0,0 +1,104 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Measure what durability costs: time N small appends to a file,
+// first with no fsync(), then with an fsync() after each one, then
+// with several processes doing the same at once (syncbench [nproc]).
+
+#define BUFSZ 512
+
+char buf[BUFSZ];
+
+enum { N = 200 };
+
+// Append N records to name, calling fsync() after each one
+// if dosync. Returns the number of ticks it took.
+int
+run(char *name, int dosync)
+{
+  int fd, i, t0;
+
+  fd = open(name, O_CREATE | O_WRONLY | O_APPEND);
+  if(fd < 0){
+    printf("syncbench: create %s failed\n", name);
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    if(write(fd, buf, BUFSZ) != BUFSZ){
+      printf("syncbench: write failed\n");
+      exit(1);
+    }
+    if(dosync && fsync(fd) != 0){
+      printf("syncbench: fsync failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  return uptime() - t0;
+}
+
+void
+report(char *what, int ticks, struct logstat *ls0)
+{
+  struct logstat ls;
+
+  logstat(&ls);
+  printf("%s: %d ticks, %d commits, %d blocks logged\n", what, ticks,
+    (int)(ls.commits - ls0->commits), (int)(ls.logged - ls0->logged));
+  *ls0 = ls;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct logstat ls;
+  char name[] = "syncbench0";
+  int i, t0, nproc, xstatus;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 4;
+  if(nproc < 1 || nproc > 9){
+    printf("usage: syncbench [nproc 1-9]\n");
+    exit(1);
+  }
+  memset(buf, 'x', BUFSZ);
+
+  logstat(&ls);
+  report("write", run("syncbench", 0), &ls);
+  unlink("syncbench");
+  report("write+fsync", run("syncbench", 1), &ls);
+  unlink("syncbench");
+
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("syncbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      name[9] = '0' + i;
+      run(name, 1);
+      exit(0);
+    }
+  }
+  for(i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  printf("%d procs ", nproc);
+  report("write+fsync", uptime() - t0, &ls);
+
+  t0 = uptime();
+  sync();
+  report("sync", uptime() - t0, &ls);
+
+  for(i = 0; i < nproc; i++){
+    name[9] = '0' + i;
+    unlink(name);
+  }
+  exit(0);
+}
@@ -1,6 +1,9 @@
 #define SBRK_ERROR ((char *)-1)
 
 struct stat;
+struct logstat;
+struct dirinfo;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -24,6 +27,19 @@ int getpid(void);
 char* sys_sbrk(int,int);
 int pause(int);
 int uptime(void);
+int logstat(struct logstat*);
+int getdents(int, struct dirinfo*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int lseek(int, int, int);
+int fsync(int);
+int sync(void);
+int sendfile(int, int, int);
+int clonefile(const char*, const char*);
+int fallocate(int, int, int);
+int pipesize(int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -582,6 +582,7 @@ void
 writebig(char *s)
 {
   int i, fd, n;
+  enum { N = NDIRECT + NINDIRECT };  // the most a single indirect block maps
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
@@ -589,7 +590,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < N; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -609,7 +610,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n != MAXFILE){
+      if(n != N){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -632,6 +633,108 @@ writebig(char *s)
   }
 }
 
+// a regular file is mapped by extents, so it can
+// grow past the single indirect block range without
+// any indirect blocks.
+void
+extentbig(char *s)
+{
+  int i, fd, n;
+  enum { N = NDIRECT + NINDIRECT + 16 };
+
+  fd = open("extentbig", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat extentbig failed!\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: error: write extentbig failed i=%d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("extentbig", O_RDONLY);
+  if(fd < 0){
+    printf("%s: error: open extentbig failed!\n", s);
+    exit(1);
+  }
+  // read several blocks at a time, from the same extent.
+  for(n = 0; (i = read(fd, buf, 3*BSIZE)) > 0; n += i/BSIZE){
+    for(int j = 0; j < i/BSIZE; j++){
+      if(((int*)(buf + j*BSIZE))[0] != n + j){
+        printf("%s: read content of block %d is %d\n", s,
+               n + j, ((int*)(buf + j*BSIZE))[0]);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  if(n != N){
+    printf("%s: read only %d blocks from extentbig\n", s, n);
+    exit(1);
+  }
+  if(unlink("extentbig") < 0){
+    printf("%s: unlink extentbig failed\n", s);
+    exit(1);
+  }
+}
+
+// a file small enough to live in its inode, growing
+// past that a few bytes at a time, then truncated.
+void
+inlinegrow(char *s)
+{
+  int i, fd, n;
+  enum { N = NINLINE + 200, CHUNK = 13 };
+
+  fd = open("inlinegrow", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat inlinegrow failed!\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i += CHUNK){
+    for(int j = 0; j < CHUNK; j++)
+      buf[j] = 'a' + (i + j) % 26;
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf("%s: error: write inlinegrow failed i=%d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("inlinegrow", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != i){
+    printf("%s: read %d bytes of inlinegrow, not %d\n", s, n, i);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(buf[i] != 'a' + i % 26){
+      printf("%s: inlinegrow byte %d is %d\n", s, i, buf[i]);
+      exit(1);
+    }
+  }
+
+  fd = open("inlinegrow", O_RDWR|O_TRUNC);
+  if(write(fd, "xyz", 3) != 3){
+    printf("%s: error: write after truncate failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inlinegrow", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != 3 || buf[0] != 'x' || buf[2] != 'z'){
+    printf("%s: inlinegrow has %d bytes after truncate\n", s, n);
+    exit(1);
+  }
+  unlink("inlinegrow");
+}
+
 // many creates, followed by unlink test
 void
 createtest(char *s)
@@ -789,6 +892,95 @@ pipe1(char *s)
 }
 
 
+// a pipe's buffer holds pipesize() bytes, and resizing
+// it keeps what's in it, even when it has wrapped.
+void
+pipesizetest(char *s)
+{
+  int fds[2], fd, i, j, n, sz, wseq, rseq;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  sz = pipesize(fds[1], 0);
+  if(sz < PGSIZE || pipesize(fds[0], 0) != sz){
+    printf("%s: pipesize %d\n", s, sz);
+    exit(1);
+  }
+
+  // fill it, wrapping once; no write should block.
+  wseq = rseq = 0;
+  for(n = 0; n < sz + 100; n += i){
+    i = sz + 100 - n < 1000 ? sz + 100 - n : 1000;
+    for(j = 0; j < i; j++)
+      buf[j] = wseq++;
+    if(write(fds[1], buf, i) != i){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(n == 0){
+      if(read(fds[0], buf, 100) != 100){
+        printf("%s: read failed\n", s);
+        exit(1);
+      }
+      rseq += 100;
+    }
+  }
+
+  if(pipesize(fds[1], sz/2) != -1){
+    printf("%s: shrank below contents\n", s);
+    exit(1);
+  }
+  if(pipesize(fds[1], sz+1) != 2*sz){
+    printf("%s: grow failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < sz; n += i){
+    i = sz - n < 1000 ? sz - n : 1000;
+    for(j = 0; j < i; j++)
+      buf[j] = wseq++;
+    if(write(fds[1], buf, i) != i){
+      printf("%s: write after grow failed\n", s);
+      exit(1);
+    }
+  }
+  close(fds[1]);
+
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(j = 0; j < n; j++){
+      if((uchar)buf[j] != (rseq++ & 0xff)){
+        printf("%s: wrong byte at %d\n", s, rseq - 1);
+        exit(1);
+      }
+    }
+  }
+  if(rseq != wseq){
+    printf("%s: read %d of %d\n", s, rseq, wseq);
+    exit(1);
+  }
+  close(fds[0]);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(pipesize(fds[0], 1<<30) != -1 || pipesize(fds[0], 1) != PGSIZE){
+    printf("%s: bad resize\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  fd = open(".", O_RDONLY);
+  if(pipesize(fd, 0) != -1){
+    printf("%s: pipesize on a directory\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -1781,6 +1973,55 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// does the log absorb repeated writes of a block within
+// one transaction, and does logstat() report them?
+void
+logabsorb(char *s)
+{
+  enum { N = (NDELAY+1)*BSIZE };
+  struct logstat st0, st1;
+  char *p;
+  int fd;
+
+  unlink("logabsorb");
+  fd = open("logabsorb", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create logabsorb\n", s);
+    exit(1);
+  }
+  if(logstat(&st0) < 0){
+    printf("%s: logstat failed\n", s);
+    exit(1);
+  }
+  // one write() is one transaction. Past NDELAY blocks it
+  // allocates the delayed ones, logging the inode block, which
+  // it logs again once it's done.
+  if((p = malloc(N)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  if(write(fd, p, N) != N){
+    printf("%s: write logabsorb failed\n", s);
+    exit(1);
+  }
+  free(p);
+  close(fd);
+  if(logstat(&st1) < 0){
+    printf("%s: logstat failed\n", s);
+    exit(1);
+  }
+  if(st1.commits <= st0.commits || st1.absorbed <= st0.absorbed){
+    printf("%s: no absorption: commits %d absorbed %d\n", s,
+           (int)(st1.commits - st0.commits), (int)(st1.absorbed - st0.absorbed));
+    exit(1);
+  }
+  if(logstat((struct logstat*)0xffffffffffL) != -1){
+    printf("%s: logstat with bad pointer succeeded\n", s);
+    exit(1);
+  }
+  unlink("logabsorb");
+}
+
 void
 fourteen(char *s)
 {
@@ -1864,6 +2105,515 @@ rmdot(char *s)
   }
 }
 
+// getdents() returns every entry once, with its inode's
+// type and size, however few it is asked for at a time.
+void
+getdentstest(char *s)
+{
+  enum { N = 70 };
+  struct dirinfo di[3];
+  char name[16];
+  int i, n, fd, tot, seen[N];
+
+  if(mkdir("gd") != 0){
+    printf("%s: mkdir gd failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[0] = 'g'; name[1] = 'd'; name[2] = '/';
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    name[5] = 0;
+    fd = open(name, O_CREATE|O_WRONLY);
+    if(fd < 0 || write(fd, buf, i) != i){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    seen[i] = 0;
+  }
+
+  fd = open("gd", O_RDONLY);
+  tot = 0;
+  while((n = getdents(fd, di, 3)) > 0){
+    for(int j = 0; j < n; j++, tot++){
+      if(di[j].name[0] == '.')
+        continue;
+      i = (di[j].name[0] - 'a') * 26 + di[j].name[1] - 'a';
+      if(i < 0 || i >= N || seen[i]++ || di[j].type != T_FILE || di[j].size != i){
+        printf("%s: getdents returned %s type %d size %d\n", s, di[j].name, di[j].type, (int)di[j].size);
+        exit(1);
+      }
+    }
+  }
+  if(n != 0 || tot != N + 2){
+    printf("%s: getdents returned %d then %d entries\n", s, n, tot);
+    exit(1);
+  }
+  if(getdents(fd, (struct dirinfo*)0xffffffffffL, 3) != 0){
+    printf("%s: getdents at end of directory didn't return 0\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("gd", O_RDONLY);
+  if(getdents(fd, (struct dirinfo*)0xffffffffffL, 3) != -1){
+    printf("%s: getdents with bad pointer succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // read() can leave the offset inside a dirent.
+  fd = open("gd", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || getdents(fd, di, 3) != -1){
+    printf("%s: getdents inside a dirent succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    unlink(name);
+  }
+  fd = open("README", O_RDONLY);
+  if(getdents(fd, di, 3) != -1){
+    printf("%s: getdents of a file succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("gd");
+}
+
+// pread() and pwrite() leave the file offset alone, and
+// readv() and writev() fill and drain their buffers in order.
+void
+prwvtest(char *s)
+{
+  struct iovec iov[MAXIOV+1];
+  char a[100], b[3000], c[11];
+  int i, fd, fds[2];
+
+  memset(a, 'a', sizeof(a));
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = i % 251;
+  memset(c, 'c', sizeof(c));
+  iov[0].base = a;
+  iov[0].len = sizeof(a);
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  iov[2].base = c;
+  iov[2].len = 0;
+  iov[3].base = c;
+  iov[3].len = 10;
+
+  fd = open("prwv", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create prwv failed\n", s);
+    exit(1);
+  }
+  if(writev(fd, iov, 4) != 3110){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "xy", 2, 50) != 2 || write(fd, "z", 1) != 1){
+    printf("%s: pwrite or write failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, c, 10, 48) != 10 || memcmp(c, "aaxyaaaaaa", 10) != 0){
+    printf("%s: pread didn't see pwrite\n", s);
+    exit(1);
+  }
+  if(pread(fd, c, 10, 3105) != 6 || memcmp(c, "cccccz", 6) != 0){
+    printf("%s: pread at end failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, c, 10, 3111) != 0){
+    printf("%s: pread past end didn't return 0\n", s);
+    exit(1);
+  }
+  if(pread(fd, c, 10, -1) != -1 || pwrite(fd, "x", 1, -1) != -1){
+    printf("%s: negative offset didn't fail\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("prwv", O_RDONLY);
+  memset(b, 0, sizeof(b));
+  iov[3].len = 11;
+  if(readv(fd, iov, 4) != 3111 || a[50] != 'x' || a[99] != 'a' ||
+     (uchar)b[2999] != 2999 % 251 || memcmp(c, "cccccccccz", 10) != 0){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "x", 1, 0) != -1){
+    printf("%s: pwrite to read-only fd succeeded\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, MAXIOV+1) != -1){
+    printf("%s: readv of %d buffers succeeded\n", s, MAXIOV+1);
+    exit(1);
+  }
+  close(fd);
+  unlink("prwv");
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fds[1], "x", 1, 0) != -1 || writev(fds[1], iov, 1) != sizeof(a)){
+    printf("%s: pwrite or writev of pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// lseek() moves the offset within the file, and O_APPEND
+// writers never overwrite each other's records.
+void
+appendtest(char *s)
+{
+  enum { NCHILD = 4, N = 50, SZ = 100 };
+  char rec[SZ];
+  int i, j, fd, pid, xstatus, seq[NCHILD];
+
+  fd = open("append", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf("%s: create append failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 0, SEEK_CUR) != 10 || lseek(fd, 4, SEEK_SET) != 4 ||
+     read(fd, rec, 2) != 2 || rec[0] != '4' || lseek(fd, -1, SEEK_END) != 9 ||
+     read(fd, rec, 2) != 1 || rec[0] != '9'){
+    printf("%s: lseek failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 11, SEEK_SET) != -1 || lseek(fd, -11, SEEK_END) != -1 ||
+     lseek(fd, 0, 3) != -1 || lseek(fd, 0, SEEK_CUR) != 10){
+    printf("%s: bad lseek succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("append");
+
+  fd = open("append", O_CREATE|O_RDWR);
+  close(fd);
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      fd = open("append", O_WRONLY|O_APPEND);
+      if(fd < 0)
+        exit(1);
+      for(j = 0; j < N; j++){
+        memset(rec, 'a' + i, SZ);
+        rec[1] = j;
+        if(write(fd, rec, SZ) != SZ)
+          exit(1);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: append child failed\n", s);
+      exit(1);
+    }
+  }
+
+  fd = open("append", O_RDONLY);
+  memset(seq, 0, sizeof(seq));
+  for(i = 0; i < NCHILD * N; i++){
+    if(read(fd, rec, SZ) != SZ){
+      printf("%s: short append file\n", s);
+      exit(1);
+    }
+    j = rec[0] - 'a';
+    if(j < 0 || j >= NCHILD || rec[1] != seq[j]++ || rec[SZ-1] != rec[0]){
+      printf("%s: appended record %d mangled\n", s, i);
+      exit(1);
+    }
+  }
+  if(read(fd, rec, 1) != 0){
+    printf("%s: append file too long\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("append");
+
+  if(pipe(seq) != 0 || lseek(seq[0], 0, SEEK_SET) != -1){
+    printf("%s: lseek of pipe succeeded\n", s);
+    exit(1);
+  }
+  close(seq[0]);
+  close(seq[1]);
+}
+
+// fsync() and sync() succeed on files and fail on pipes,
+// and leave the data in place.
+void
+fsynctest(char *s)
+{
+  int i, fd, fds[2];
+
+  fd = open("fsync", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsync failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 5; i++){
+    memset(buf, 'a' + i, 1000);
+    if(write(fd, buf, 1000) != 1000 || fsync(fd) != 0){
+      printf("%s: write or fsync failed\n", s);
+      exit(1);
+    }
+  }
+  if(sync() != 0){
+    printf("%s: sync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("fsync", O_RDONLY);
+  if(fsync(fd) != 0 || read(fd, buf, 5000) != 5000 ||
+     buf[0] != 'a' || buf[4999] != 'e'){
+    printf("%s: fsync of read-only file or readback failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsync");
+
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0 || fsync(fds[1]) != -1){
+    printf("%s: fsync of pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// sendfile() copies from a file's offset to another file
+// or to a pipe, and won't read from a pipe.
+void
+sendfiletest(char *s)
+{
+  enum { SZ = 10000 };
+  int i, n, in, out, fds[2], xstatus;
+
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 199;
+  in = open("sendin", O_CREATE|O_RDWR);
+  if(in < 0 || write(in, buf, SZ) != SZ){
+    printf("%s: create sendin failed\n", s);
+    exit(1);
+  }
+  close(in);
+
+  in = open("sendin", O_RDONLY);
+  out = open("sendout", O_CREATE|O_WRONLY);
+  if(read(in, buf, 10) != 10 || write(out, "0123456789", 10) != 10){
+    printf("%s: write sendout failed\n", s);
+    exit(1);
+  }
+  if((n = sendfile(out, in, 2*SZ)) != SZ - 10){
+    printf("%s: sendfile to file returned %d\n", s, n);
+    exit(1);
+  }
+  if((n = sendfile(out, in, 1)) != 0 || (n = sendfile(out, in, 0)) != 0){
+    printf("%s: sendfile at end of file returned %d\n", s, n);
+    exit(1);
+  }
+  if(sendfile(in, out, 1) != -1 || sendfile(out, out, 1) != -1){
+    printf("%s: sendfile against modes succeeded\n", s);
+    exit(1);
+  }
+  close(out);
+  out = open("sendout", O_RDONLY);
+  if(read(out, buf, SZ+1) != SZ || buf[9] != '9' || (uchar)buf[10] != 10 % 199 ||
+     (uchar)buf[SZ-1] != (SZ-1) % 199){
+    printf("%s: sendfile copied wrong data\n", s);
+    exit(1);
+  }
+  close(out);
+  unlink("sendout");
+
+  if(pipe(fds) != 0 || sendfile(fds[1], fds[0], 1) != -1){
+    printf("%s: sendfile from pipe succeeded\n", s);
+    exit(1);
+  }
+  if(fork() == 0){
+    close(fds[1]);
+    for(i = 0; (n = read(fds[0], buf, 1000)) > 0; i += n)
+      if((uchar)buf[0] != i % 199)
+        exit(1);
+    exit(i == SZ ? 0 : 1);
+  }
+  close(fds[0]);
+  lseek(in, 0, SEEK_SET);
+  if(sendfile(fds[1], in, SZ) != SZ){
+    printf("%s: sendfile to pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: pipe reader saw wrong data\n", s);
+    exit(1);
+  }
+
+  // a failed write doesn't use up the input.
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  lseek(in, 0, SEEK_SET);
+  if(sendfile(fds[1], in, SZ) != -1 || lseek(in, 0, SEEK_CUR) != 0){
+    printf("%s: failed sendfile moved the offset\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  close(in);
+  unlink("sendin");
+}
+
+// clonefile() makes a copy that shares the original's blocks
+// until either file writes them.
+void
+clonetest(char *s)
+{
+  enum { SZ = 10*BSIZE };
+  int i, fd;
+
+  fd = open("clone0", O_CREATE|O_RDWR);
+  memset(buf, 'a', SZ);
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: create clone0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(clonefile("clone0", "clone1") != 0){
+    printf("%s: clonefile failed\n", s);
+    exit(1);
+  }
+  if(clonefile("clone0", "clone0") != -1 || clonefile(".", "clone2") != -1 ||
+     clonefile("noclone", "clone2") != -1){
+    printf("%s: bad clonefile succeeded\n", s);
+    exit(1);
+  }
+  if((fd = open("clone2", O_RDONLY)) >= 0){
+    printf("%s: failed clonefile created its target\n", s);
+    exit(1);
+  }
+
+  fd = open("clone1", O_RDWR);
+  if(fd < 0 || pwrite(fd, "bb", 2, BSIZE-1) != 2 || pwrite(fd, "c", 1, SZ-1) != 1){
+    printf("%s: write to clone failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("clone0", O_RDONLY);
+  if(read(fd, buf, SZ+1) != SZ){
+    printf("%s: clone0 changed size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != 'a'){
+      printf("%s: writing the clone changed clone0\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("clone0");
+
+  fd = open("clone1", O_RDONLY);
+  if(read(fd, buf, SZ+1) != SZ || buf[BSIZE-2] != 'a' || buf[BSIZE-1] != 'b' ||
+     buf[BSIZE] != 'b' || buf[BSIZE+1] != 'a' || buf[SZ-1] != 'c'){
+    printf("%s: clone1 has wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("clone1");
+}
+
+// fallocate() gives a file blocks without changing its size,
+// and writes then fill them in. A call that can't have all
+// the blocks it asks for gets none.
+void
+fallocatetest(char *s)
+{
+  enum { SZ = 10*BSIZE };
+  struct stat st;
+  int i, fd;
+
+  fd = open("falloc", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf("%s: create falloc failed\n", s);
+    exit(1);
+  }
+  if(fallocate(fd, 0, SZ) != 0 || fstat(fd, &st) != 0 || st.size != 1){
+    printf("%s: fallocate failed or changed the size\n", s);
+    exit(1);
+  }
+  for(i = 1; i < SZ; i += 700){
+    memset(buf, 'a' + i % 26, 700);
+    if(write(fd, buf, 700) != 700){
+      printf("%s: write to preallocated blocks failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("falloc", O_RDONLY);
+  if(read(fd, buf, SZ+700) != 1 + (SZ-1+699)/700*700 || buf[0] != 'x'){
+    printf("%s: wrong size after writes\n", s);
+    exit(1);
+  }
+  for(i = 1; i < SZ; i++){
+    if(buf[i] != 'a' + (i - (i-1) % 700) % 26){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(fallocate(fd, 0, SZ) != -1){
+    printf("%s: fallocate of read-only fd succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // asking for more than the disk has fails and takes nothing.
+  fd = open("falloc", O_RDWR);
+  if(fd < 0 || fallocate(fd, 0, 0x7fffffff) != -1){
+    printf("%s: fallocate of more than the disk didn't fail\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("falloc2", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: failed fallocate kept the free blocks\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("falloc2");
+  unlink("falloc");
+
+  fd = open(".", O_RDONLY);
+  if(fallocate(fd, 0, BSIZE) != -1){
+    printf("%s: fallocate of directory succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
 void
 dirfile(char *s)
 {
@@ -2767,10 +3517,13 @@ struct test {
   {opentest, "opentest"},
   {writetest, "writetest"},
   {writebig, "writebig"},
+  {extentbig, "extentbig"},
+  {inlinegrow, "inlinegrow"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipesizetest, "pipesize"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2790,9 +3543,17 @@ struct test {
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
+  {logabsorb, "logabsorb"},
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
+  {getdentstest, "getdents"},
+  {prwvtest, "prwv"},
+  {appendtest, "append"},
+  {fsynctest, "fsync"},
+  {sendfiletest, "sendfile"},
+  {clonetest, "clone"},
+  {fallocatetest, "fallocate"},
   {iref, "iref"},
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
@@ -2864,6 +3625,134 @@ bigdir(char *s)
   }
 }
 
+// only directories are mapped by the block map, so grow one
+// past its direct blocks, look every name up again, and remove
+// it, which frees the single indirect block.
+void
+bigdirind(char *s)
+{
+  enum { N = 1800 };
+  int i, fd, n;
+  char name[16];
+  struct dirent de;
+  struct stat st;
+
+  if(mkdir("bdi") < 0){
+    printf("%s: mkdir bdi failed\n", s);
+    exit(1);
+  }
+  fd = open("bdi/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create bdi/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  strcpy(name, "bdi/x");
+  for(i = 0; i < N; i++){
+    name[5] = '0' + (i / 64);
+    name[6] = '0' + (i % 64);
+    name[7] = '\0';
+    if(link("bdi/f", name) != 0){
+      printf("%s: link(bdi/f, %s) failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  fd = open("bdi", O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) < 0){
+    printf("%s: open bdi failed\n", s);
+    exit(1);
+  }
+  if(st.size <= NDIRECT*BSIZE){
+    printf("%s: bdi has only %d bytes\n", s, (int)st.size);
+    exit(1);
+  }
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      n++;
+  close(fd);
+  if(n != N + 3){  // and ".", "..", "f"
+    printf("%s: read %d entries from bdi\n", s, n);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[5] = '0' + (i / 64);
+    name[6] = '0' + (i % 64);
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("bdi/f") != 0 || unlink("bdi") != 0){
+    printf("%s: unlink bdi failed\n", s);
+    exit(1);
+  }
+}
+
+// concurrent large writes: the file data blocks of calls that
+// have ended stay in the running transaction until it commits,
+// which the other writer keeps from happening.
+void
+concwrite(char *s)
+{
+  enum { NCHILD = 3, N = 100*BSIZE, CHUNK = 30*BSIZE };
+  char name[4], *p;
+  int ci, i, n, fd, xstatus;
+
+  for(ci = 0; ci < NCHILD; ci++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[0] = 'c';
+      name[1] = 'w';
+      name[2] = '0' + ci;
+      name[3] = '\0';
+      if((p = malloc(CHUNK)) == 0)
+        exit(1);
+      fd = open(name, O_CREATE|O_RDWR);
+      if(fd < 0)
+        exit(1);
+      for(i = 0; i < N; i += CHUNK){
+        n = N - i < CHUNK ? N - i : CHUNK;
+        memset(p, 'a' + ci + i/CHUNK, n);
+        if(write(fd, p, n) != n){
+          printf("%s: write %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      close(fd);
+      fd = open(name, O_RDONLY);
+      for(i = 0; i < N; i += CHUNK){
+        n = N - i < CHUNK ? N - i : CHUNK;
+        if(read(fd, p, n) != n || p[0] != 'a' + ci + i/CHUNK ||
+           p[n-1] != 'a' + ci + i/CHUNK){
+          printf("%s: read %s got wrong data\n", s, name);
+          exit(1);
+        }
+      }
+      close(fd);
+      unlink(name);
+      exit(0);
+    }
+  }
+  for(ci = 0; ci < NCHILD; ci++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
 // concurrent writes to try to provoke deadlock in the virtio disk
 // driver.
 void
@@ -3106,7 +3995,9 @@ outofinodes(char *s)
 
 struct test slowtests[] = {
   {bigdir, "bigdir"},
+  {bigdirind, "bigdirind"},
   {manywrites, "manywrites"},
+  {concwrite, "concwrite"},
   {badwrite, "badwrite" },
   {execout, "execout"},
   {diskfull, "diskfull"},
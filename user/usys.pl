@@ -42,3 +42,16 @@ entry("getpid");
 entry("sbrk");
 entry("pause");
 entry("uptime");
+entry("logstat");
+entry("getdents");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("lseek");
+entry("fsync");
+entry("sync");
+entry("sendfile");
+entry("clonefile");
+entry("fallocate");
+entry("pipesize");